@@ -7,7 +7,9 @@
 #include "dump.h"
 #include "history.h"
 #include "opcode.h"
+#include "trace.h"
 #include "type.h"
+#include "undo.h"
 
 static void help(const char* cmd)
 {
@@ -25,28 +27,51 @@ static void help(const char* cmd)
     // project 2
     puts("opcode mnemonic");
     puts("opcodelist");
-    puts("assemble filename");
+    puts("assemble filename [--binary]");
     puts("type filename");
-    puts("symbol");
+    puts("symbol [stats]");
 
     // project 3
     puts("progaddr [address]");
-    puts("loader [object filename1] [object filename2] [...]");
-    puts("run");
+    puts("loader [object filename1] [object filename2] [...] [@listfile]");
+    puts("run [threaded|check|jit|jitcheck] [--profile] [--record]");
+    puts("rstep [count]");
+    puts("rcontinue");
     puts("bp [address]");
     puts("bp clear");
     puts("bp");
+    puts("trace [on|off|dump filename]");
+    puts("snapshot [save|restore name]");
 }
 
-int main()
+static int usage(const char* prog)
 {
-    initialize_hash_table();
+    fprintf(stderr, "usage: %s [--assemble [--binary] file... | --run jobfile]\n", prog);
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    // non-interactive batch assembly and runs
+    if (argc > 1) {
+        if (strcmp(argv[1], "--assemble") == 0 && argc > 2) {
+            int binary = strcmp(argv[2], "--binary") == 0;
+            if (argc > 2 + binary) {
+                return assemble_batch(argc - 2 - binary, argv + 2 + binary, binary);
+            }
+        }
+        if (strcmp(argv[1], "--run") == 0 && argc == 3) {
+            return run_batch(argv[2]);
+        }
+        return usage(argv[0]);
+    }
 
     while (1) {
         printf("sicsim> ");
 
-        char input[256], cmd[256];
-        if (!fgets(input, 256, stdin)) {
+        // long enough for a loader with dozens of object files
+        char input[4096], cmd[256];
+        if (!fgets(input, sizeof(input), stdin)) {
             return 0;
         }
 
@@ -94,8 +119,16 @@ int main()
             f = loader;
         } else if (strcmp(cmd, "run") == 0) {
             f = run;
+        } else if (strcmp(cmd, "rstep") == 0) {
+            f = rstep;
+        } else if (strcmp(cmd, "rcontinue") == 0) {
+            f = rcontinue;
         } else if (strcmp(cmd, "bp") == 0) {
             f = breakpoint;
+        } else if (strcmp(cmd, "trace") == 0) {
+            f = trace;
+        } else if (strcmp(cmd, "snapshot") == 0) {
+            f = snapshot;
         } else {
             puts("No such comamnd.");
             continue;
@@ -105,10 +138,11 @@ int main()
         f(input + strlen(cmd));
     }
 
-    free_opcode_table();
     free_history();
     free_symbols();
-    free_breakpoints();
+    free_console();
+    free_trace();
+    free_undo();
 
     return 0;
 }
@@ -1,14 +1,27 @@
 #include "assemble.h"
+#include "objbin.h"
 #include "opcode.h"
+#include "outbuf.h"
+#include "parallel.h"
 #include "symtab.h"
 
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #define TEXT_RECORD_SIZE 0x1F
 #define MOD_RECORD_SIZE 1024
 
+// first line of file.cache; bump CACHE_VERSION when the output format changes
+#define CACHE_MAGIC "SICASM-CACHE"
+#define CACHE_VERSION 1
+
+// lines per unit of work when encoding in parallel
+#define ENCODE_CHUNK 4096
+
 enum directives {
     DIRECTIVE_WORD = -2,
     DIRECTIVE_RESW = -3,
@@ -19,11 +32,17 @@ enum directives {
     DIRECTIVE_BASE = -8,
 };
 
+// slice of the source line, not NUL-terminated
+struct token {
+    const char* str;
+    int len;
+};
+
 struct operation {
     char prefix;
     int opcode;
     enum op_format format;
-    char name[10];
+    struct token name;
 };
 
 struct parse_result {
@@ -32,20 +51,72 @@ struct parse_result {
         PARSE_RESULT_VALID,
         PARSE_RESULT_ERROR = -1
     } result;
-    char label[10];
+    struct token label;
     struct operation op;
     char operand_prefix;
-    char operands[100];
+    struct token operands;
 };
 
-static struct parse_result parse_line(const char* line)
+static int is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static const char* skip_space(const char* s, const char* end)
+{
+    while (s < end && is_space(*s)) {
+        ++s;
+    }
+    return s;
+}
+
+// skip whitespace, then take at most max non-whitespace characters
+static struct token scan_word(const char** s, const char* end, int max)
+{
+    const char* p = skip_space(*s, end);
+    struct token tok = { p, 0 };
+    while (p < end && tok.len < max && !is_space(*p)) {
+        ++p;
+        ++tok.len;
+    }
+    *s = p;
+    return tok;
+}
+
+static int token_equals(struct token tok, const char* str)
+{
+    return (int)strlen(str) == tok.len && memcmp(tok.str, str, tok.len) == 0;
+}
+
+// first operand: at most 99 characters up to a ',' or ' '
+static struct token scan_operand(const char** s, const char* end)
+{
+    struct token tok = { *s, 0 };
+    while (*s < end && tok.len < 99 && **s != ',' && **s != ' ') {
+        ++*s;
+        ++tok.len;
+    }
+    return tok;
+}
+
+// optional whitespace, a ',' and more optional whitespace
+static int scan_comma(const char** s, const char* end)
+{
+    const char* p = skip_space(*s, end);
+    if (p == end || *p != ',') {
+        return 0;
+    }
+    *s = skip_space(p + 1, end);
+    return 1;
+}
+
+static struct parse_result parse_line(const char* line, const char* end)
 {
     struct parse_result res;
-    int n;
 
     res.result = PARSE_RESULT_ERROR;
 
-    if (line[0] == 0) {
+    if (line == end) {
         return res;
     }
     if (line[0] == '.') {
@@ -53,101 +124,142 @@ static struct parse_result parse_line(const char* line)
         return res;
     }
 
-    if (line[0] == ' ') {
-        // no label
-        res.label[0] = 0;
-    } else {
-        sscanf(line, "%9s%n", res.label, &n);
-        line += n;
+    res.label.str = line;
+    res.label.len = 0;
+    if (line[0] != ' ') {
+        res.label = scan_word(&line, end, 9);
+        if (res.label.len == 0) {
+            return res;
+        }
     }
 
     // scan opcode
     res.op.prefix = 0;
 
-    char prefix;
-    if (sscanf(line, " %c%n", &prefix, &n) == 1) {
-        if (prefix == '+') {
-            res.op.prefix = prefix;
-            line += n;
-        }
+    line = skip_space(line, end);
+    if (line < end && *line == '+') {
+        res.op.prefix = '+';
+        line++;
     }
 
-    if (sscanf(line, "%9s%n", res.op.name, &n) != 1) {
+    res.op.name = scan_word(&line, end, 9);
+    if (res.op.name.len == 0) {
         return res;
     }
-    res.op.opcode = find_opcode(res.op.name);
-    if (res.op.opcode == -1) {
-        if (strcmp(res.op.name, "WORD") == 0) {
-            res.op.opcode = DIRECTIVE_WORD;
-        } else if (strcmp(res.op.name, "RESW") == 0) {
-            res.op.opcode = DIRECTIVE_RESW;
-        } else if (strcmp(res.op.name, "RESB") == 0) {
-            res.op.opcode = DIRECTIVE_RESB;
-        } else if (strcmp(res.op.name, "BYTE") == 0) {
-            res.op.opcode = DIRECTIVE_BYTE;
-        } else if (strcmp(res.op.name, "START") == 0) {
-            res.op.opcode = DIRECTIVE_START;
-        } else if (strcmp(res.op.name, "BASE") == 0) {
-            res.op.opcode = DIRECTIVE_BASE;
-        } else if (strcmp(res.op.name, "END") == 0) {
-            res.op.opcode = DIRECTIVE_END;
-        } else {
-            return res;
-        }
-    } else {
-        res.op.format = find_op_format(res.op.name);
-    }
-    line += n;
-
-    // scan operand 0
-    res.operands[0] = 0;
-    if (sscanf(line, " %99[^#@\n]", res.operands) == 1) {
-        res.operand_prefix = 0;
-    } else if (sscanf(line, " #%99[^#@\n]", res.operands) == 1) {
-        res.operand_prefix = '#';
-    } else if (sscanf(line, " @%99[^#@\n]", res.operands) == 1) {
-        res.operand_prefix = '@';
+
+    const struct opcode_info* info = lookup_opcode(res.op.name.str, res.op.name.len);
+    if (info) {
+        res.op.opcode = info->opcode;
+        res.op.format = info->format;
+    } else if (token_equals(res.op.name, "WORD")) {
+        res.op.opcode = DIRECTIVE_WORD;
+    } else if (token_equals(res.op.name, "RESW")) {
+        res.op.opcode = DIRECTIVE_RESW;
+    } else if (token_equals(res.op.name, "RESB")) {
+        res.op.opcode = DIRECTIVE_RESB;
+    } else if (token_equals(res.op.name, "BYTE")) {
+        res.op.opcode = DIRECTIVE_BYTE;
+    } else if (token_equals(res.op.name, "START")) {
+        res.op.opcode = DIRECTIVE_START;
+    } else if (token_equals(res.op.name, "BASE")) {
+        res.op.opcode = DIRECTIVE_BASE;
+    } else if (token_equals(res.op.name, "END")) {
+        res.op.opcode = DIRECTIVE_END;
     } else {
-        // no operands
-        res.operand_prefix = 0;
+        return res;
+    }
+
+    // scan operand 0: an optional '#' or '@' followed by at most 99
+    // characters up to the next '#', '@' or the end of the line
+    line = skip_space(line, end);
+
+    char prefix = 0;
+    if (line < end && (*line == '#' || *line == '@')) {
+        prefix = *line++;
     }
 
+    res.operands.str = line;
+    res.operands.len = 0;
+    while (line < end && res.operands.len < 99 && *line != '#' && *line != '@') {
+        ++line;
+        ++res.operands.len;
+    }
+
+    // a lone prefix counts as no operands
+    res.operand_prefix = res.operands.len > 0 ? prefix : 0;
+
     res.result = PARSE_RESULT_VALID;
 
     return res;
 }
 
-struct im_parse_result {
-    int address;
-    int pc;
-    struct parse_result p;
-};
-
-static struct im_parse_result parse_im_line(const char* line)
+// same as sscanf("%d"): leading whitespace, optional sign, decimal digits
+static int parse_int(struct token tok, int* result)
 {
-    struct im_parse_result res;
-    int n;
-    if (sscanf(line, "%d|%d|%n", &res.address, &res.pc, &n) != 2) {
-        res.address = -1;
-        return res;
+    const char* p = skip_space(tok.str, tok.str + tok.len);
+    const char* end = tok.str + tok.len;
+
+    int neg = 0;
+    if (p < end && (*p == '+' || *p == '-')) {
+        neg = *p == '-';
+        p++;
     }
-    res.p = parse_line(line + n);
-    return res;
-}
 
-static int parse_int(const char* str, int* result)
-{
-    if (sscanf(str, "%d", result) != 1) {
+    if (p == end || !isdigit((unsigned char)*p)) {
         return -1;
     }
+
+    long long val = 0;
+    for (; p < end && isdigit((unsigned char)*p); ++p) {
+        if (val <= 0xffffffffll) {
+            val = val * 10 + (*p - '0');
+        }
+    }
+
+    *result = (int)(neg ? -val : val);
     return 0;
 }
 
-static int parse_hexint(const char* str, int* result)
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// same as sscanf("%x"): leading whitespace, optional sign and 0x, hex digits
+static int parse_hexint(struct token tok, int* result)
 {
-    if (sscanf(str, "%x", result) != 1) {
+    const char* p = skip_space(tok.str, tok.str + tok.len);
+    const char* end = tok.str + tok.len;
+
+    int neg = 0;
+    if (p < end && (*p == '+' || *p == '-')) {
+        neg = *p == '-';
+        p++;
+    }
+
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') && hex_digit(p[2]) >= 0) {
+        p += 2;
+    }
+
+    if (p == end || hex_digit(*p) < 0) {
         return -1;
     }
+
+    long long val = 0;
+    for (; p < end && hex_digit(*p) >= 0; ++p) {
+        if (val <= 0xffffffffll) {
+            val = val * 16 + hex_digit(*p);
+        }
+    }
+
+    *result = (int)(neg ? -val : val);
     return 0;
 }
 
@@ -164,19 +276,21 @@ static void switch_extension(const char* orig, const char* ext, char* result)
     strcat(result, ext);
 }
 
-static int parse_byte_string(const char* str, char* result, int max_size)
+static int parse_byte_string(struct token tok, char* result, int max_size)
 {
+    const char* str = tok.str;
+    int n = tok.len;
     int i = 0;
-    while (str[i] && isspace(str[i])) {
+    while (i < n && is_space(str[i])) {
         ++i;
     }
 
-    if (str[i] == 'X' && str[i + 1] == '\'') {
+    if (i + 1 < n && str[i] == 'X' && str[i + 1] == '\'') {
         // parse hex string
 
         i += 2;
         int j;
-        for (j = 0; j / 2 < max_size && isxdigit(str[i]) && (isdigit(str[i]) || isupper(str[i])); ++i, ++j) {
+        for (j = 0; j / 2 < max_size && i < n && isxdigit(str[i]) && (isdigit(str[i]) || isupper(str[i])); ++i, ++j) {
             int hex = isdigit(str[i]) ? str[i] - '0' : str[i] - 'A' + 10;
             if (j % 2 == 0) {
                 result[j / 2] = (hex << 4) & 0xff;
@@ -189,22 +303,22 @@ static int parse_byte_string(const char* str, char* result, int max_size)
             return -1;
         }
 
-        if (str[i] != '\'') {
+        if (i == n || str[i] != '\'') {
             return -1;
         }
 
         return j / 2;
 
-    } else if (str[i] == 'C' && str[i + 1] == '\'') {
+    } else if (i + 1 < n && str[i] == 'C' && str[i + 1] == '\'') {
         // parse char string
 
         i += 2;
         int j = 0;
-        while (j < max_size && str[i] && str[i] != '\'') {
+        while (j < max_size && i < n && str[i] != '\'') {
             result[j++] = str[i++];
         }
 
-        if (str[i] != '\'') {
+        if (i == n || str[i] != '\'') {
             return -1;
         }
 
@@ -214,30 +328,30 @@ static int parse_byte_string(const char* str, char* result, int max_size)
     return -1;
 }
 
-static int calc_ins_length(int lineno, struct parse_result* parse)
+static int calc_ins_length(FILE* out, int lineno, struct parse_result* parse)
 {
     if (parse->op.opcode == DIRECTIVE_WORD) {
         int word;
         if (parse_int(parse->operands, &word)) {
-            printf("%d: Error: cannot parse number\n", lineno);
+            fprintf(out, "%d: Error: cannot parse number\n", lineno);
             return -1;
         }
         if (word > 0xffffff || word < -0x800000) {
-            printf("%d: Error: integer out of range\n", lineno);
+            fprintf(out, "%d: Error: integer out of range\n", lineno);
             return -1;
         }
         return 3;
     } else if (parse->op.opcode == DIRECTIVE_RESW) {
         int num_words;
         if (parse_int(parse->operands, &num_words)) {
-            printf("%d: Error: cannot parse number\n", lineno);
+            fprintf(out, "%d: Error: cannot parse number\n", lineno);
             return -1;
         }
         return 3 * num_words;
     } else if (parse->op.opcode == DIRECTIVE_RESB) {
         int num_bytes;
         if (parse_int(parse->operands, &num_bytes)) {
-            printf("%d: Error: cannot parse number\n", lineno);
+            fprintf(out, "%d: Error: cannot parse number\n", lineno);
             return -1;
         }
         return num_bytes;
@@ -245,13 +359,13 @@ static int calc_ins_length(int lineno, struct parse_result* parse)
         char str[4096];
         int len = parse_byte_string(parse->operands, str, sizeof(str));
         if (len < 0) {
-            printf("%d: Error: cannot parse byte string\n", lineno);
+            fprintf(out, "%d: Error: cannot parse byte string\n", lineno);
             return -1;
         }
         return len;
     } else {
         if (parse->op.opcode == -1) {
-            printf("%d: Error: invalid opcode\n", lineno);
+            fprintf(out, "%d: Error: invalid opcode\n", lineno);
             return -1;
         }
 
@@ -267,124 +381,251 @@ static int calc_ins_length(int lineno, struct parse_result* parse)
                 return 3;
             }
         case FORMAT_NOT_FOUND:
-            printf("%d: Error: invalid opcode\n", lineno);
+            fprintf(out, "%d: Error: invalid opcode\n", lineno);
             return -1;
         }
     }
     return -1;
 }
 
-static int first_pass(const char* file, FILE* tmp, symtab symbols)
+// one source line after the first pass
+struct ir_line {
+    int address; // -1 for comment lines
+    int pc;
+    const char* text;
+    struct parse_result p;
+    int value; // WORD value
+    int sym; // symbol id of the first operand, -1 if none
+    int data; // offset of the decoded BYTE payload in ir.data
+    int len; // length of the BYTE payload
+};
+
+// intermediate representation handed from the first pass to the second pass
+struct ir {
+    char* source;
+    struct ir_line* lines;
+    int nlines;
+    int cap;
+    unsigned char* data;
+    int ndata;
+    int datacap;
+    int start_line; // index of the START line, -1 until it is seen
+    int starting_address;
+};
+
+static void ir_init(struct ir* ir)
+{
+    ir->source = NULL;
+    ir->lines = NULL;
+    ir->nlines = ir->cap = 0;
+    ir->data = NULL;
+    ir->ndata = ir->datacap = 0;
+    ir->start_line = -1;
+    ir->starting_address = -1;
+}
+
+static void ir_free(struct ir* ir)
+{
+    free(ir->source);
+    free(ir->lines);
+    free(ir->data);
+}
+
+static struct ir_line* ir_add_line(struct ir* ir, const char* text, int address, int pc)
+{
+    if (ir->nlines == ir->cap) {
+        ir->cap = ir->cap ? ir->cap * 2 : 256;
+        ir->lines = realloc(ir->lines, sizeof(struct ir_line) * ir->cap);
+    }
+
+    struct ir_line* l = &ir->lines[ir->nlines++];
+    l->address = address;
+    l->pc = pc;
+    l->text = text;
+    l->value = 0;
+    l->sym = -1;
+    l->data = 0;
+    l->len = 0;
+    return l;
+}
+
+static unsigned char* ir_reserve_data(struct ir* ir, int len)
+{
+    if (ir->ndata + len > ir->datacap) {
+        while (ir->ndata + len > ir->datacap) {
+            ir->datacap = ir->datacap ? ir->datacap * 2 : 4096;
+        }
+        ir->data = realloc(ir->data, ir->datacap);
+    }
+
+    return ir->data + ir->ndata;
+}
+
+static char* read_file(const char* file, size_t* length)
 {
-    FILE* fp = fopen(file, "r");
+    FILE* fp = fopen(file, "rb");
     if (!fp) {
-        printf("Cannot open file %s.\n", file);
-        return -1;
+        return NULL;
     }
 
-    int starting_address = -1;
-    int loc_ctr = 0;
+    size_t size = 0, cap = 65536;
+    char* buf = malloc(cap + 1);
+    size_t n;
+    while ((n = fread(buf + size, 1, cap - size, fp)) > 0) {
+        size += n;
+        if (size == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap + 1);
+        }
+    }
+    buf[size] = 0;
+    *length = size;
 
-    char line[4096];
-    int first_real_line = 1;
-    for (int lineno = 1; fgets(line, sizeof(line), fp); lineno++) {
-        if (!strchr(line, '\n')) {
-            printf("%d: Error: line too long\n", lineno);
-            goto error;
+    fclose(fp);
+    return buf;
+}
+
+// runs the first pass from line to the END directive, appending to ir;
+// ir already holds the lines before it and loc_ctr is the location
+// counter at that point
+static int first_pass(FILE* out, struct ir* ir, symtab symbols, char* line, int loc_ctr)
+{
+    for (int lineno = ir->nlines + 1; *line; lineno++) {
+        char* eol = strchr(line, '\n');
+        if (!eol || eol - line >= 4095) {
+            fprintf(out, "%d: Error: line too long\n", lineno);
+            return -1;
         }
+        *eol = 0;
 
-        struct parse_result parse = parse_line(line);
+        struct parse_result parse = parse_line(line, eol);
 
         if (parse.result == PARSE_RESULT_ERROR) {
-            printf("%d: Error: parse error\n", lineno);
-            goto error;
+            fprintf(out, "%d: Error: parse error\n", lineno);
+            return -1;
         }
 
         if (parse.result == PARSE_RESULT_COMMENT) {
-            fprintf(tmp, "%s", line);
+            ir_add_line(ir, line, -1, -1);
+            line = eol + 1;
             continue;
         }
 
-        if (first_real_line) {
-            first_real_line = 0;
+        struct ir_line* l;
+
+        if (ir->start_line == -1) {
             if (parse.op.opcode != DIRECTIVE_START) {
-                printf("%d: Error: file does not begin with START directive.\n", lineno);
-                goto error;
+                fprintf(out, "%d: Error: file does not begin with START directive.\n", lineno);
+                return -1;
             }
 
-            if (parse_hexint(parse.operands, &starting_address)) {
-                printf("%d: Error: cannot parse number\n", lineno);
-                goto error;
+            if (parse_hexint(parse.operands, &ir->starting_address)) {
+                fprintf(out, "%d: Error: cannot parse number\n", lineno);
+                return -1;
             }
-            loc_ctr = starting_address;
+            loc_ctr = ir->starting_address;
+            ir->start_line = ir->nlines;
 
-            fprintf(tmp, "%d|%d|%s", loc_ctr, loc_ctr, line);
+            l = ir_add_line(ir, line, loc_ctr, loc_ctr);
+            l->p = parse;
+            line = eol + 1;
             continue;
         } else if (parse.op.opcode == DIRECTIVE_END) {
-            fprintf(tmp, "%d|%d|%s", loc_ctr, loc_ctr, line);
+            l = ir_add_line(ir, line, loc_ctr, loc_ctr);
+            l->p = parse;
             break;
         } else if (parse.op.opcode == DIRECTIVE_BASE) {
-            fprintf(tmp, "%d|%d|%s", loc_ctr, loc_ctr, line);
+            l = ir_add_line(ir, line, loc_ctr, loc_ctr);
+            l->p = parse;
+
+            const char* p = parse.operands.str;
+            struct token tok = scan_word(&p, p + parse.operands.len, 99);
+            int num;
+            if (tok.len > 0 && parse_int(tok, &num)) {
+                l->sym = symtab_intern(symbols, tok.str, tok.len);
+            }
+
+            line = eol + 1;
             continue;
         }
 
         // if label exists
-        if (parse.label[0]) {
-            if (symtab_find(symbols, parse.label) != -1) {
-                printf("%d: Error: duplicate symbol '%s'\n", lineno, parse.label);
-                goto error;
+        if (parse.label.len) {
+            int id = symtab_intern(symbols, parse.label.str, parse.label.len);
+            if (symtab_address(symbols, id) != -1) {
+                fprintf(out, "%d: Error: duplicate symbol '%.*s'\n", lineno, parse.label.len, parse.label.str);
+                return -1;
             }
-            symtab_insert(symbols, parse.label, loc_ctr);
+            // earlier references to the label resolve through the same id
+            symtab_define(symbols, id, loc_ctr);
         }
 
         // calculate instruction/directive length
-        int len = calc_ins_length(lineno, &parse);
+        int len = calc_ins_length(out, lineno, &parse);
         if (len < 0) {
-            goto error;
+            return -1;
         }
 
-        loc_ctr += len;
+        l = ir_add_line(ir, line, loc_ctr, loc_ctr + len);
+        l->p = parse;
+
+        // keep the decoded data so the second pass need not parse it again
+        if (parse.op.opcode == DIRECTIVE_BYTE) {
+            l->data = ir->ndata;
+            l->len = parse_byte_string(parse.operands, (char*)ir_reserve_data(ir, len), len);
+            ir->ndata += len;
+        } else if (parse.op.opcode == DIRECTIVE_WORD) {
+            parse_int(parse.operands, &l->value);
+        } else if (parse.op.format == FORMAT_3_4) {
+            const char* p = parse.operands.str;
+            struct token operand = scan_operand(&p, p + parse.operands.len);
+            // numbers such as #3 are left to parse_int when encoding
+            int num;
+            if (operand.len > 0 && parse_int(operand, &num)) {
+                l->sym = symtab_intern(symbols, operand.str, operand.len);
+            }
+        }
 
-        fprintf(tmp, "%d|%d|%s", loc_ctr - len, loc_ctr, line);
+        loc_ctr += len;
+        line = eol + 1;
     }
 
-    fclose(fp);
-
-    rewind(tmp);
-
-    return loc_ctr - starting_address;
-
-error:
-    fclose(fp);
-
-    return -1;
+    return loc_ctr - ir->starting_address;
 }
 
-static void write_listing(FILE* lst, int lineno, struct im_parse_result* parse, unsigned char* code, int len)
+static void write_listing(struct outbuf* lst, int lineno, struct ir_line* parse, unsigned char* code, int len)
 {
-    fprintf(lst, "%4d   ", lineno * 5);
-    fprintf(lst, "%04X   ", parse->address);
+    outbuf_dec(lst, lineno * 5, 4);
+    outbuf_puts(lst, "   ");
+    outbuf_hex(lst, parse->address, 4);
+    outbuf_puts(lst, "   ");
     if (parse->p.op.prefix) {
-        fprintf(lst, "%-9s", parse->p.label);
-        fprintf(lst, "%c", parse->p.op.prefix);
+        outbuf_pad(lst, parse->p.label.str, parse->p.label.len, 9);
+        outbuf_putc(lst, parse->p.op.prefix);
     } else {
-        fprintf(lst, "%-10s", parse->p.label);
+        outbuf_pad(lst, parse->p.label.str, parse->p.label.len, 10);
     }
 
     if (parse->p.operand_prefix) {
-        fprintf(lst, "%-9s", parse->p.op.name);
-        fprintf(lst, "%c", parse->p.operand_prefix);
+        outbuf_pad(lst, parse->p.op.name.str, parse->p.op.name.len, 9);
+        outbuf_putc(lst, parse->p.operand_prefix);
     } else {
-        fprintf(lst, "%-10s", parse->p.op.name);
+        outbuf_pad(lst, parse->p.op.name.str, parse->p.op.name.len, 10);
     }
 
-    fprintf(lst, "%-20s", parse->p.operands);
-
-    for (int i = 0; i < len; ++i) {
-        fprintf(lst, "%02X", code[i]);
-    }
+    outbuf_pad(lst, parse->p.operands.str, parse->p.operands.len, 20);
+    outbuf_hex_bytes(lst, code, len);
+    outbuf_putc(lst, '\n');
+}
 
-    fprintf(lst, "\n");
+// listing line for BASE and END, which have no address
+static void write_directive(struct outbuf* lst, int lineno, const char* name, struct token operands)
+{
+    outbuf_dec(lst, lineno * 5, 4);
+    outbuf_pad(lst, "", 0, 20);
+    outbuf_pad(lst, name, (int)strlen(name), 10);
+    outbuf_pad(lst, operands.str, operands.len, 20);
+    outbuf_putc(lst, '\n');
 }
 
 struct text_record {
@@ -393,7 +634,8 @@ struct text_record {
     unsigned char text[TEXT_RECORD_SIZE];
 };
 
-static void flush_text_record(FILE* obj, struct text_record* rec, int start_address)
+// writes rec to obj, or to bin for a binary object file
+static void flush_text_record(struct outbuf* obj, struct objbin_builder* bin, struct text_record* rec, int start_address)
 {
     // no need to write 0-byte text records
     if (rec->len == 0) {
@@ -402,35 +644,39 @@ static void flush_text_record(FILE* obj, struct text_record* rec, int start_addr
         return;
     }
 
-    fprintf(obj, "T%06X%02X", rec->start_address, rec->len);
-    for (int i = 0; i < rec->len; ++i) {
-        fprintf(obj, "%02X", rec->text[i]);
+    if (bin) {
+        objbin_add_text(bin, rec->start_address, rec->text, rec->len);
+    } else {
+        outbuf_putc(obj, 'T');
+        outbuf_hex(obj, rec->start_address, 6);
+        outbuf_hex(obj, rec->len, 2);
+        outbuf_hex_bytes(obj, rec->text, rec->len);
+        outbuf_putc(obj, '\n');
     }
-    fprintf(obj, "\n");
 
     rec->start_address = start_address;
     rec->len = 0;
 }
 
-static int get_reg_num(const char* r)
+static int get_reg_num(struct token r)
 {
-    if (strcmp(r, "A") == 0) {
+    if (token_equals(r, "A")) {
         return 0;
-    } else if (strcmp(r, "X") == 0) {
+    } else if (token_equals(r, "X")) {
         return 1;
-    } else if (strcmp(r, "L") == 0) {
+    } else if (token_equals(r, "L")) {
         return 2;
-    } else if (strcmp(r, "PC") == 0) {
+    } else if (token_equals(r, "PC")) {
         return 8;
-    } else if (strcmp(r, "SW") == 0) {
+    } else if (token_equals(r, "SW")) {
         return 9;
-    } else if (strcmp(r, "B") == 0) {
+    } else if (token_equals(r, "B")) {
         return 3;
-    } else if (strcmp(r, "S") == 0) {
+    } else if (token_equals(r, "S")) {
         return 4;
-    } else if (strcmp(r, "T") == 0) {
+    } else if (token_equals(r, "T")) {
         return 5;
-    } else if (strcmp(r, "F") == 0) {
+    } else if (token_equals(r, "F")) {
         return 6;
     }
     return -1;
@@ -446,18 +692,34 @@ struct mod_rec_array {
     int len;
 };
 
+#define ERROR_SIZE 256
+
 struct ins_context {
     int lineno;
     int base_addr;
     symtab symbols;
+    int sym;
     int pc;
     int opcode;
     char op_prefix;
     enum op_format fmt;
     char operand_prefix;
-    const char* operands;
+    struct token operands;
+    char* error; // ERROR_SIZE bytes for the error message
 };
 
+// instructions may be encoded on worker threads, so errors are kept in
+// the context and printed in line order by second_pass
+static void ins_error(struct ins_context* ctx, const char* fmt, ...)
+{
+    int n = snprintf(ctx->error, ERROR_SIZE, "%d: Error: ", ctx->lineno);
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(ctx->error + n, ERROR_SIZE - n, fmt, args);
+    va_end(args);
+}
+
 static int assemble_ins(struct ins_context* ctx, unsigned char* output, struct modification_record* rec)
 {
     rec->start_address = -1;
@@ -468,17 +730,27 @@ static int assemble_ins(struct ins_context* ctx, unsigned char* output, struct m
         return 1;
 
     } else if (ctx->fmt == FORMAT_2) {
-        char r1[100], r2[100];
-        int cnt;
+        const char* p = ctx->operands.str;
+        const char* end = p + ctx->operands.len;
+        struct token r1 = scan_operand(&p, end), r2 = { p, 0 };
+        int cnt = 0;
+
+        if (r1.len > 0) {
+            cnt = 1;
+            if (scan_comma(&p, end)) {
+                r2 = scan_word(&p, end, 99);
+                cnt += r2.len > 0;
+            }
+        }
 
         output[0] = ctx->opcode & 0xff;
 
-        if ((cnt = sscanf(ctx->operands, "%99[^, ] , %99s", r1, r2)) >= 1) {
+        if (cnt >= 1) {
             if (cnt == 1) {
                 int nr1 = get_reg_num(r1);
 
                 if (nr1 == -1) {
-                    printf("%d: Error: no such register\n", ctx->lineno);
+                    ins_error(ctx, "no such register");
                     return -1;
                 }
 
@@ -488,14 +760,14 @@ static int assemble_ins(struct ins_context* ctx, unsigned char* output, struct m
                 int nr2 = get_reg_num(r2);
 
                 if (nr1 == -1 || nr2 == -1) {
-                    printf("%d: Error: no such register\n", ctx->lineno);
+                    ins_error(ctx, "no such register");
                     return -1;
                 }
 
                 output[1] = (nr1 << 4 | nr2) & 0xff;
             }
         } else {
-            printf("%d: Error: incorrect format 2 operands\n", ctx->lineno);
+            ins_error(ctx, "incorrect format 2 operands");
             return -1;
         }
 
@@ -503,41 +775,52 @@ static int assemble_ins(struct ins_context* ctx, unsigned char* output, struct m
 
     } else if (ctx->fmt == FORMAT_3_4) {
         // Format 3/4
-        char m[100], ch;
-        int cnt;
+        const char* p = ctx->operands.str;
+        const char* end = p + ctx->operands.len;
+        struct token operand = scan_operand(&p, end);
+        char ch = 0;
+        int cnt = 0;
         int is_simple = 0, is_immediate = 0, is_indirect = 0;
         int is_extended = ctx->op_prefix == '+';
 
+        if (operand.len > 0) {
+            cnt = 1;
+            if (scan_comma(&p, end) && p < end) {
+                ch = *p;
+                cnt = 2;
+            }
+        }
+
         output[0] = ctx->opcode & 0xfc;
 
-        if ((cnt = sscanf(ctx->operands, "%99[^, ] , %c", m, &ch)) >= 1) {
+        if (cnt >= 1) {
             // simple addressing
             is_simple = ctx->operand_prefix == 0;
             is_immediate = ctx->operand_prefix == '#';
             is_indirect = ctx->operand_prefix == '@';
-        } else if (sscanf(ctx->operands, " %c", &ch) != 1) {
+        } else if (skip_space(ctx->operands.str, end) == end) {
             output[0] |= 0x03;
             output[1] = 0;
             output[2] = 0;
             return 3;
         } else {
-            printf("%d: Error: unrecognized format 3 operands\n", ctx->lineno);
+            ins_error(ctx, "unrecognized format 3 operands");
             return -1;
         }
 
         // simple addressing
-        int addr = symtab_find(ctx->symbols, m);
+        int addr = symtab_address(ctx->symbols, ctx->sym);
 
         int is_absolute = 0;
         if (addr == -1) {
             if (is_immediate) {
-                if (parse_int(m, &addr)) {
-                    printf("%d: Error: symbol not found or cannot parse int '%s'\n", ctx->lineno, m);
+                if (parse_int(operand, &addr)) {
+                    ins_error(ctx, "symbol not found or cannot parse int '%.*s'", operand.len, operand.str);
                     return -1;
                 }
                 is_absolute = 1;
             } else {
-                printf("%d: Error: symbol '%s' not found\n", ctx->lineno, m);
+                ins_error(ctx, "symbol '%.*s' not found", operand.len, operand.str);
                 return -1;
             }
         }
@@ -571,7 +854,7 @@ static int assemble_ins(struct ins_context* ctx, unsigned char* output, struct m
                 rel = base_rel;
                 output[1] |= 0x40;
             } else {
-                printf("%d: Error: cannot be addressed in format 3\n", ctx->lineno);
+                ins_error(ctx, "cannot be addressed in format 3");
                 return -1;
             }
         }
@@ -612,57 +895,192 @@ static int assemble_ins(struct ins_context* ctx, unsigned char* output, struct m
         }
     }
 
-    printf("%d: Error: unrecognized instruction format\n", ctx->lineno);
+    ins_error(ctx, "unrecognized instruction format");
     return -1;
 }
 
-static int second_pass(const char* file, int program_length, FILE* tmp, symtab symbols)
+// output of assemble_ins for one line
+struct encoding {
+    unsigned char code[4];
+    int len; // -1 on error
+    struct modification_record mod; // start_address is -1 if none
+    int base; // BASE address and operand address the code was made with
+    int sym_addr;
+};
+
+// encodings of a previous run that may be copied for unchanged lines
+struct reuse {
+    const struct ir* ir;
+    const struct encoding* enc;
+    int prefix; // lines before prefix are the same in both runs
+    int suffix; // so are the lines from suffix on,
+    int shift; // which were at line - shift in the previous run
+};
+
+struct encode_job {
+    struct ir* ir;
+    symtab symbols;
+    const int* base; // BASE address in effect at each line
+    struct encoding* enc;
+    char (*errors)[ERROR_SIZE]; // first error of each chunk
+    const struct reuse* reuse; // NULL if there is no previous run
+};
+
+static int is_instruction(const struct ir_line* l)
+{
+    return l->address != -1 && l->p.op.opcode >= 0;
+}
+
+// previous encoding of line i if the line has the same text and was
+// encoded with the same addresses, so it would encode the same way
+static const struct encoding* reusable(const struct reuse* r, int i, const struct ir_line* l, int base, int sym_addr)
+{
+    int j;
+    if (!r) {
+        return NULL;
+    } else if (i < r->prefix) {
+        j = i;
+    } else if (i >= r->suffix) {
+        j = i - r->shift;
+    } else {
+        return NULL;
+    }
+
+    const struct ir_line* old = &r->ir->lines[j];
+    const struct encoding* e = &r->enc[j];
+    if (old->address != l->address || old->pc != l->pc || e->base != base || e->sym_addr != sym_addr) {
+        return NULL;
+    }
+    return e;
+}
+
+// encodes one chunk of lines, stopping at its first error; lines after
+// an error are never written out, so they need not be encoded
+static void encode_chunk(void* arg, int chunk)
+{
+    struct encode_job* job = arg;
+    int first = chunk * ENCODE_CHUNK;
+    int last = first + ENCODE_CHUNK;
+    if (last > job->ir->nlines) {
+        last = job->ir->nlines;
+    }
+
+    for (int i = first; i < last; ++i) {
+        struct ir_line* l = &job->ir->lines[i];
+        if (!is_instruction(l)) {
+            continue;
+        }
+
+        struct ins_context ctx;
+        ctx.lineno = i + 1;
+        ctx.base_addr = job->base[i];
+        ctx.symbols = job->symbols;
+        ctx.sym = l->sym;
+        ctx.pc = l->pc;
+        ctx.opcode = l->p.op.opcode;
+        ctx.op_prefix = l->p.op.prefix;
+        ctx.fmt = l->p.op.format;
+        ctx.operand_prefix = l->p.operand_prefix;
+        ctx.operands = l->p.operands;
+        ctx.error = job->errors[chunk];
+
+        struct encoding* e = &job->enc[i];
+        int sym_addr = symtab_address(job->symbols, l->sym);
+        const struct encoding* old = reusable(job->reuse, i, l, ctx.base_addr, sym_addr);
+        if (old) {
+            *e = *old;
+            continue;
+        }
+
+        e->len = assemble_ins(&ctx, e->code, &e->mod);
+        e->base = ctx.base_addr;
+        e->sym_addr = sym_addr;
+
+        if (e->len == -1) {
+            break;
+        }
+    }
+}
+
+// encodes every instruction; only the BASE directive carries state from
+// one line to the next, so it is resolved first and the rest is split
+// into chunks that are encoded independently
+static void encode_all(struct ir* ir, symtab symbols, const struct reuse* reuse, struct encoding* enc, char (*errors)[ERROR_SIZE], int nthreads)
+{
+    int* base = malloc(sizeof(int) * (ir->nlines + 1));
+    int base_addr = -1;
+    for (int i = 0; i < ir->nlines; ++i) {
+        base[i] = base_addr;
+        if (ir->lines[i].address != -1 && ir->lines[i].p.op.opcode == DIRECTIVE_BASE) {
+            base_addr = symtab_address(symbols, ir->lines[i].sym);
+        }
+    }
+
+    struct encode_job job = { ir, symbols, base, enc, errors, reuse };
+    int nchunks = (ir->nlines + ENCODE_CHUNK - 1) / ENCODE_CHUNK;
+    parallel_for(nchunks, nthreads, encode_chunk, &job);
+
+    free(base);
+}
+
+// writes file.lst and file.obj, in the binary object format if binary is
+// set; the encodings are handed back in *encodings so that a later run
+// can reuse them
+static int second_pass(FILE* out, const char* file, int program_length, struct ir* ir, symtab symbols,
+    const struct reuse* reuse, struct encoding** encodings, int binary, int nthreads)
 {
+    *encodings = NULL;
+
     char lstfile[104];
     switch_extension(file, ".lst", lstfile);
-    FILE* lst = fopen(lstfile, "w");
-    if (!lst) {
-        printf("Cannot open %s for writing.\n", lstfile);
+    struct outbuf lstbuf, *lst = &lstbuf;
+    if (outbuf_open(lst, lstfile) == -1) {
+        fprintf(out, "Cannot open %s for writing.\n", lstfile);
         return -1;
     }
 
+    // a binary object file is collected and written at the end
     char objfile[104];
     switch_extension(file, ".obj", objfile);
-    FILE* obj = fopen(objfile, "w");
-    if (!obj) {
-        printf("Cannot open %s for writing.\n", objfile);
-        fclose(lst);
+    struct outbuf objbuf, *obj = binary ? NULL : &objbuf;
+    struct objbin_builder binbuf, *bin = binary ? &binbuf : NULL;
+    if (bin) {
+        objbin_init(bin, "", 0, 0);
+    } else if (outbuf_open(obj, objfile) == -1) {
+        fprintf(out, "Cannot open %s for writing.\n", objfile);
+        outbuf_close(lst);
         return -1;
     }
 
+    struct encoding* enc = malloc(sizeof(struct encoding) * (ir->nlines + 1));
+    char(*errors)[ERROR_SIZE] = malloc(ERROR_SIZE * ((ir->nlines + ENCODE_CHUNK - 1) / ENCODE_CHUNK + 1));
+    encode_all(ir, symbols, reuse, enc, errors, nthreads);
+    *encodings = enc;
+
     int starting_address = 0;
-    int base_addr = -1;
 
     struct text_record rec = { 0, 0, "" };
     struct mod_rec_array mod_rec;
     mod_rec.len = 0;
 
-    char line[4096];
     int first_real_line = 1;
     int first_executable_addr = -1;
-    for (int lineno = 1; fgets(line, sizeof(line), tmp); lineno++) {
-        if (!strchr(line, '\n')) {
-            printf("%d: Error: line too long\n", lineno);
-            goto error;
-        }
-
-        struct im_parse_result parse = parse_im_line(line);
+    for (int lineno = 1; lineno <= ir->nlines; lineno++) {
+        struct ir_line parse = ir->lines[lineno - 1];
 
         // comment
         if (parse.address == -1) {
-            fprintf(lst, "%4d%10s%s", lineno * 5, "", line);
+            outbuf_dec(lst, lineno * 5, 4);
+            outbuf_pad(lst, "", 0, 10);
+            outbuf_puts(lst, parse.text);
+            outbuf_putc(lst, '\n');
             continue;
         }
 
         if (first_real_line) {
             first_real_line = 0;
             if (parse.p.op.opcode != DIRECTIVE_START) {
-                printf("%d: Error: file does not begin with START directive.\n", lineno);
+                fprintf(out, "%d: Error: file does not begin with START directive.\n", lineno);
                 goto error;
             }
 
@@ -670,63 +1088,82 @@ static int second_pass(const char* file, int program_length, FILE* tmp, symtab s
 
             starting_address = parse.address;
 
-            fprintf(obj, "H%-6s%06X%06X\n", parse.p.label, starting_address, program_length);
+            if (bin) {
+                // nothing has been added to bin yet
+                char name[8];
+                snprintf(name, sizeof(name), "%.*s", parse.p.label.len, parse.p.label.str);
+                objbin_init(bin, name, starting_address, program_length);
+            } else {
+                outbuf_putc(obj, 'H');
+                outbuf_pad(obj, parse.p.label.str, parse.p.label.len, 6);
+                outbuf_hex(obj, starting_address, 6);
+                outbuf_hex(obj, program_length, 6);
+                outbuf_putc(obj, '\n');
+            }
 
-            flush_text_record(obj, &rec, starting_address);
+            flush_text_record(obj, bin, &rec, starting_address);
             continue;
 
         } else if (parse.p.op.opcode == DIRECTIVE_BASE) {
-            char sym[100];
-            if (sscanf(parse.p.operands, "%99s", sym) != 1) {
-                printf("%d: Error: invalid BASE operand\n", lineno);
+            const char* p = parse.p.operands.str;
+            struct token tok = scan_word(&p, p + parse.p.operands.len, 99);
+            if (tok.len == 0) {
+                fprintf(out, "%d: Error: invalid BASE operand\n", lineno);
                 goto error;
             }
 
-            int addr = symtab_find(symbols, sym);
-            if (addr == -1) {
-                printf("%d: Error: no such symbol '%s'", lineno, sym);
+            // a number was never interned, so it is not found either
+            if (symtab_address(symbols, parse.sym) == -1) {
+                fprintf(out, "%d: Error: no such symbol '%.*s'", lineno, tok.len, tok.str);
                 goto error;
             }
 
-            base_addr = addr;
-
-            fprintf(lst, "%4d%20s%-10s%-20s\n", lineno * 5, "", "BASE", parse.p.operands);
+            write_directive(lst, lineno, "BASE", parse.p.operands);
 
             continue;
         } else if (parse.p.op.opcode == DIRECTIVE_END) {
-            flush_text_record(obj, &rec, 0);
+            flush_text_record(obj, bin, &rec, 0);
 
             for (int i = 0; i < mod_rec.len; ++i) {
-                fprintf(obj, "M%06X%02X\n", mod_rec.rec[i].start_address, mod_rec.rec[i].len);
+                if (bin) {
+                    // relative to the control section, as 01 is
+                    objbin_add_modify(bin, mod_rec.rec[i].start_address, mod_rec.rec[i].len, 0x01, 1);
+                    continue;
+                }
+                outbuf_putc(obj, 'M');
+                outbuf_hex(obj, mod_rec.rec[i].start_address, 6);
+                outbuf_hex(obj, mod_rec.rec[i].len, 2);
+                outbuf_putc(obj, '\n');
             }
 
             if (first_executable_addr == -1) {
-                printf("%d: Error: Cannot find executable code in assembly.\n", lineno);
+                fprintf(out, "%d: Error: Cannot find executable code in assembly.\n", lineno);
             }
 
-            fprintf(obj, "E%06X\n", first_executable_addr);
+            if (bin) {
+                bin->header.entry = first_executable_addr == -1 ? OBJBIN_NONE : (uint32_t)first_executable_addr;
+            } else {
+                outbuf_putc(obj, 'E');
+                outbuf_hex(obj, first_executable_addr, 6);
+                outbuf_putc(obj, '\n');
+            }
 
-            fprintf(lst, "%4d%20s%-10s%-20s\n", lineno * 5, "", "END", parse.p.operands);
+            write_directive(lst, lineno, "END", parse.p.operands);
 
             break;
         }
 
         if (parse.p.op.opcode == DIRECTIVE_BYTE) {
-            char str[4096];
-
-            int len = parse_byte_string(parse.p.operands, str, sizeof(str));
-            if (len < 0) {
-                printf("%d: Error: cannot parse byte string\n", lineno);
-                goto error;
-            }
+            const unsigned char* str = ir->data + parse.data;
+            int len = parse.len;
 
             // write to text record
             if (rec.len + len >= TEXT_RECORD_SIZE) {
-                flush_text_record(obj, &rec, parse.address);
+                flush_text_record(obj, bin, &rec, parse.address);
             }
 
             if (len > TEXT_RECORD_SIZE) {
-                printf("%d: Error: byte string exceeds text record size\n", lineno);
+                fprintf(out, "%d: Error: byte string exceeds text record size\n", lineno);
                 goto error;
             }
 
@@ -737,19 +1174,11 @@ static int second_pass(const char* file, int program_length, FILE* tmp, symtab s
             write_listing(lst, lineno, &parse, rec.text + rec.len - len, len);
 
         } else if (parse.p.op.opcode == DIRECTIVE_WORD) {
-            int word;
-            if (parse_int(parse.p.operands, &word)) {
-                printf("%d: Error: cannot parse number\n", lineno);
-                return -1;
-            }
-            if (word > 0xffffff || word < -0x800000) {
-                printf("%d: Error: integer out of range\n", lineno);
-                return -1;
-            }
+            int word = parse.value;
 
             // write to text record
             if (rec.len + 3 >= TEXT_RECORD_SIZE) {
-                flush_text_record(obj, &rec, parse.address);
+                flush_text_record(obj, bin, &rec, parse.address);
             }
 
             rec.text[rec.len++] = (word >> 16) & 0xff;
@@ -761,54 +1190,43 @@ static int second_pass(const char* file, int program_length, FILE* tmp, symtab s
         } else if (parse.p.op.opcode == DIRECTIVE_RESW) {
 
             // flush text record
-            flush_text_record(obj, &rec, parse.pc);
+            flush_text_record(obj, bin, &rec, parse.pc);
 
             write_listing(lst, lineno, &parse, NULL, 0);
 
         } else if (parse.p.op.opcode == DIRECTIVE_RESB) {
 
-            flush_text_record(obj, &rec, parse.pc);
+            flush_text_record(obj, bin, &rec, parse.pc);
 
             write_listing(lst, lineno, &parse, NULL, 0);
 
         } else {
-            struct ins_context ctx;
-            ctx.lineno = lineno;
-            ctx.base_addr = base_addr;
-            ctx.symbols = symbols;
-            ctx.pc = parse.pc;
-            ctx.opcode = parse.p.op.opcode;
-
             if (parse.p.op.opcode == -1) {
-                printf("%d: Error: invalid opcode\n", lineno);
+                fprintf(out, "%d: Error: invalid opcode\n", lineno);
                 goto error;
             }
 
-            ctx.op_prefix = parse.p.op.prefix;
-            ctx.fmt = parse.p.op.format;
-            ctx.operand_prefix = parse.p.operand_prefix;
-            ctx.operands = parse.p.operands;
-
-            unsigned char instruction[4];
-            struct modification_record mrec;
-            int len = assemble_ins(&ctx, instruction, &mrec);
+            struct encoding* e = &enc[lineno - 1];
+            unsigned char* instruction = e->code;
+            int len = e->len;
 
             // add modification record
-            if (mrec.start_address >= 0) {
+            if (e->mod.start_address >= 0) {
                 if (mod_rec.len + 1 >= MOD_RECORD_SIZE) {
-                    printf("%d: Error: too many modification records\n", lineno);
-                    return -1;
+                    fprintf(out, "%d: Error: too many modification records\n", lineno);
+                    goto error;
                 }
 
-                mod_rec.rec[mod_rec.len++] = mrec;
+                mod_rec.rec[mod_rec.len++] = e->mod;
             }
 
             if (len == -1) {
+                fprintf(out, "%s\n", errors[(lineno - 1) / ENCODE_CHUNK]);
                 goto error;
             }
 
             if (rec.len + len >= TEXT_RECORD_SIZE) {
-                flush_text_record(obj, &rec, parse.address);
+                flush_text_record(obj, bin, &rec, parse.address);
             }
 
             for (int i = 0; i < len; ++i) {
@@ -823,55 +1241,424 @@ static int second_pass(const char* file, int program_length, FILE* tmp, symtab s
         }
     }
 
-    fclose(lst);
-    fclose(obj);
+    // a short write, such as on a full disk, is only known here
+    int result = 0;
+    if (outbuf_close(lst) == -1) {
+        fprintf(out, "Cannot write %s.\n", lstfile);
+        result = -1;
+    }
+    free(errors);
+    if (bin) {
+        int written = objbin_write(bin, objfile);
+        objbin_free(bin);
+        if (written == -1) {
+            fprintf(out, "Cannot write %s.\n", objfile);
+            result = -1;
+        }
+    } else if (outbuf_close(obj) == -1) {
+        fprintf(out, "Cannot write %s.\n", objfile);
+        result = -1;
+    }
 
-    return 0;
+    return result;
 
 error:
-    fclose(lst);
-    fclose(obj);
+    outbuf_close(lst);
+    if (bin) {
+        objbin_free(bin);
+    } else {
+        outbuf_close(obj);
+    }
+    free(errors);
 
     return -1;
 }
 
+// hash of everything the output depends on: the source, the opcode table,
+// the object format and the cache format
+static unsigned long long source_hash(const char* source, size_t size, int binary)
+{
+    unsigned long long hash = 0xcbf29ce484222325ull ^ opcode_table_fingerprint();
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)source[i];
+        hash *= 0x100000001b3ull;
+    }
+    hash ^= CACHE_VERSION;
+    hash *= 0x100000001b3ull;
+    hash ^= binary;
+    hash *= 0x100000001b3ull;
+    return hash;
+}
+
+static int is_up_to_date(const char* output, const struct stat* cache)
+{
+    struct stat st;
+    if (stat(output, &st) == -1) {
+        return 0;
+    }
+    // an output written after the cache was not written by us
+    return st.st_mtime <= cache->st_mtime;
+}
+
+// fills symbols, unless it is NULL, from file.cache if it was written for
+// the same source and both outputs are still there; returns -1 if the file
+// must be assembled
+static int load_cache(const char* file, unsigned long long hash, symtab symbols)
+{
+    char cachefile[108], lstfile[104], objfile[104];
+    switch_extension(file, ".cache", cachefile);
+    switch_extension(file, ".lst", lstfile);
+    switch_extension(file, ".obj", objfile);
+
+    struct stat st;
+    if (stat(cachefile, &st) == -1 || !is_up_to_date(lstfile, &st) || !is_up_to_date(objfile, &st)) {
+        return -1;
+    }
+
+    size_t size;
+    char* buf = read_file(cachefile, &size);
+    if (!buf) {
+        return -1;
+    }
+
+    // header, then one "label address" line per symbol
+    unsigned long long cached;
+    int n;
+    if (sscanf(buf, CACHE_MAGIC " %llx%n", &cached, &n) != 1 || cached != hash) {
+        free(buf);
+        return -1;
+    }
+
+    // check the whole file before touching the symbol table
+    for (int pass = 0; pass < 2; ++pass) {
+        const char* p = buf + n;
+        char label[100];
+        int address, m;
+        while (sscanf(p, "%99s %x%n", label, &address, &m) == 2) {
+            if (pass == 1 && symbols) {
+                symtab_insert(symbols, label, address);
+            }
+            p += m;
+        }
+        if (sscanf(p, " %c", label) == 1) {
+            free(buf);
+            return -1;
+        }
+    }
+
+    free(buf);
+    return 0;
+}
+
+static void save_cache(const char* file, unsigned long long hash, symtab symbols)
+{
+    char cachefile[108];
+    switch_extension(file, ".cache", cachefile);
+
+    FILE* fp = fopen(cachefile, "w");
+    if (!fp) {
+        return;
+    }
+
+    fprintf(fp, CACHE_MAGIC " %016llx\n", hash);
+    for (int id = 0; id < symtab_count(symbols); ++id) {
+        int address = symtab_address(symbols, id);
+        if (address != -1) {
+            fprintf(fp, "%s %X\n", symtab_label(symbols, id), address);
+        }
+    }
+
+    if (fclose(fp) != 0) {
+        remove(cachefile);
+    }
+}
+
+static void remove_cache(const char* file)
+{
+    char cachefile[108];
+    switch_extension(file, ".cache", cachefile);
+    remove(cachefile);
+}
+
+// the result of a previous run, kept so that an edited file can be
+// reassembled from its first changed line
+struct assembly {
+    char file[100];
+    unsigned long long hash;
+    struct ir ir;
+    struct encoding* enc; // NULL if there is no previous run
+};
+
+static void assembly_clear(struct assembly* state)
+{
+    if (state->enc) {
+        ir_free(&state->ir);
+        free(state->enc);
+        state->enc = NULL;
+    }
+}
+
+// number of leading lines of source that are the same as in the previous
+// run; they are split off as the first pass would and *line is set to the
+// first line that is not
+static int unchanged_prefix(const struct ir* prev, char* source, char** line)
+{
+    char* p = source;
+    int i;
+    // the last line is always parsed again, so that the first pass ends
+    // where it did before
+    for (i = 0; i < prev->nlines - 1; ++i) {
+        const char* text = prev->lines[i].text;
+        size_t len = strlen(text);
+        if (strncmp(p, text, len) != 0 || p[len] != '\n') {
+            break;
+        }
+        p[len] = 0;
+        p += len + 1;
+    }
+    *line = p;
+    return i;
+}
+
+static void rebase(const char** str, const char* from, const char* to)
+{
+    *str = to + (*str - from);
+}
+
+// starts ir with the first k lines of prev, which are the same in both
+// sources, and returns the location counter after them
+static int copy_prefix(struct ir* ir, const struct ir* prev, int k, symtab symbols)
+{
+    int loc_ctr = prev->starting_address;
+    int ndata = 0;
+    for (int i = 0; i < k; ++i) {
+        struct ir_line* l = ir_add_line(ir, NULL, 0, 0);
+        *l = prev->lines[i];
+        rebase(&l->text, prev->source, ir->source);
+        if (l->address == -1) {
+            continue;
+        }
+
+        rebase(&l->p.label.str, prev->source, ir->source);
+        rebase(&l->p.op.name.str, prev->source, ir->source);
+        rebase(&l->p.operands.str, prev->source, ir->source);
+        loc_ctr = l->pc;
+        // BYTE data is stored in line order
+        if (l->p.op.opcode == DIRECTIVE_BYTE) {
+            ndata = l->data + l->len;
+        }
+    }
+    ir->start_line = prev->start_line;
+    ir->starting_address = prev->starting_address;
+    if (ndata) {
+        memcpy(ir_reserve_data(ir, ndata), prev->data, ndata);
+        ir->ndata = ndata;
+    }
+
+    // labels of the lines after the prefix are defined again by the first
+    // pass, which must not see them as duplicates
+    for (int i = k; i < prev->nlines; ++i) {
+        const struct ir_line* l = &prev->lines[i];
+        if (l->address == -1 || i == prev->start_line || !l->p.label.len
+            || l->p.op.opcode == DIRECTIVE_BASE || l->p.op.opcode == DIRECTIVE_END) {
+            continue;
+        }
+        symtab_define(symbols, symtab_intern(symbols, l->p.label.str, l->p.label.len), -1);
+    }
+
+    return loc_ctr;
+}
+
+// assembles file into *symbols, reusing the previous run in state; if
+// state holds a run, *symbols must be the table it produced, otherwise an
+// empty one, and it may be replaced when the run cannot be reused
+static int assemble_incremental(FILE* out, const char* file, symtab* symbols, struct assembly* state, int binary, int nthreads)
+{
+    struct ir ir;
+    ir_init(&ir);
+
+    size_t size;
+    ir.source = read_file(file, &size);
+    if (!ir.source) {
+        fprintf(out, "Cannot open file %s.\n", file);
+        return -1;
+    }
+
+    // skip both passes if nothing changed since the last run
+    unsigned long long hash = source_hash(ir.source, size, binary);
+    if (load_cache(file, hash, NULL) == 0) {
+        if (!state->enc || state->hash != hash) {
+            if (state->enc) {
+                assembly_clear(state);
+                symtab_free(*symbols);
+                *symbols = symtab_init();
+            }
+            load_cache(file, hash, *symbols);
+        }
+        ir_free(&ir);
+        return 1;
+    }
+
+    // only the lines from the first changed one on go through the first
+    // pass again; a changed START line changes every address
+    char* line = ir.source;
+    int loc_ctr = 0;
+    struct reuse reuse = { NULL, NULL, 0, 0, 0 };
+    if (state->enc) {
+        int k = unchanged_prefix(&state->ir, ir.source, &line);
+        if (k > state->ir.start_line) {
+            loc_ctr = copy_prefix(&ir, &state->ir, k, *symbols);
+            reuse.ir = &state->ir;
+            reuse.enc = state->enc;
+            reuse.prefix = k;
+        } else {
+            assembly_clear(state);
+            symtab_free(*symbols);
+            *symbols = symtab_init();
+            line = ir.source;
+        }
+    }
+
+    int result = -1;
+    struct encoding* enc = NULL;
+    int program_length = first_pass(out, &ir, *symbols, line, loc_ctr);
+    if (program_length != -1) {
+        if (reuse.enc) {
+            // lines at the end that are the same as before
+            const struct ir* prev = reuse.ir;
+            int n = 0;
+            while (n < ir.nlines - reuse.prefix && n < prev->nlines - reuse.prefix
+                && strcmp(ir.lines[ir.nlines - 1 - n].text, prev->lines[prev->nlines - 1 - n].text) == 0) {
+                n++;
+            }
+            reuse.suffix = ir.nlines - n;
+            reuse.shift = ir.nlines - prev->nlines;
+        }
+        result = second_pass(out, file, program_length, &ir, *symbols, reuse.enc ? &reuse : NULL, &enc, binary, nthreads);
+    }
+
+    assembly_clear(state);
+    if (result == 0) {
+        save_cache(file, hash, *symbols);
+        snprintf(state->file, sizeof(state->file), "%s", file);
+        state->hash = hash;
+        state->ir = ir;
+        state->enc = enc;
+    } else {
+        remove_cache(file);
+        free(enc);
+        ir_free(&ir);
+    }
+
+    return result;
+}
+
+int assemble_file(FILE* out, const char* file, symtab symbols, int binary, int nthreads)
+{
+    struct assembly state;
+    state.enc = NULL;
+
+    int result = assemble_incremental(out, file, &symbols, &state, binary, nthreads);
+    assembly_clear(&state);
+    return result;
+}
+
 static symtab symbols = NULL;
+static struct assembly last;
 
 void assemble(const char* cmd)
 {
-    char ch, file[100];
-    if (sscanf(cmd, "%99s %c", file, &ch) != 1) {
+    char ch, file[100], option[10];
+    int cnt = sscanf(cmd, "%99s %9s %c", file, option, &ch);
+    if (cnt != 1 && (cnt != 2 || strcmp(option, "--binary") != 0)) {
         printf("Invalid command.\n");
         return;
     }
 
-    free_symbols();
-    symbols = symtab_init();
+    // the previous run can only be reused for the same file
+    if (!last.enc || strcmp(last.file, file) != 0) {
+        assembly_clear(&last);
+        free_symbols();
+        symbols = symtab_init();
+    }
+
+    assemble_incremental(stdout, file, &symbols, &last, cnt == 2, parallel_threads());
+}
 
-    FILE* tmp = tmpfile();
-    if (!tmp) {
-        printf("Cannot open temporary file.\n");
-        symtab_free(symbols);
-        return;
+struct batch_job {
+    const char* file;
+    int binary;
+    char* output;
+    size_t size;
+    int result;
+};
+
+static void assemble_job(void* arg, int i)
+{
+    struct batch_job* job = (struct batch_job*)arg + i;
+
+    // messages are collected and printed once all jobs are done
+    FILE* out = open_memstream(&job->output, &job->size);
+    symtab tab = symtab_init();
+
+    // names are limited as on the console, which the buffers for the
+    // .lst, .obj and .cache names rely on
+    if (strlen(job->file) > 99) {
+        fprintf(out ? out : stdout, "File name too long.\n");
+        job->result = -1;
+    } else {
+        // the jobs already keep every core busy
+        job->result = assemble_file(out ? out : stdout, job->file, tab, job->binary, 1);
     }
 
-    int program_length = first_pass(file, tmp, symbols);
-    if (program_length == -1) {
-        goto cleanup;
+    symtab_free(tab);
+    if (out) {
+        fclose(out);
     }
+}
 
-    if (second_pass(file, program_length, tmp, symbols) == -1) {
-        goto cleanup;
+int assemble_batch(int nfiles, char** files, int binary)
+{
+    struct batch_job* jobs = malloc(sizeof(struct batch_job) * nfiles);
+    for (int i = 0; i < nfiles; ++i) {
+        jobs[i].file = files[i];
+        jobs[i].binary = binary;
+        jobs[i].output = NULL;
+        jobs[i].size = 0;
+    }
+
+    parallel_for(nfiles, parallel_threads(), assemble_job, jobs);
+
+    int failed = 0, cached = 0;
+    for (int i = 0; i < nfiles; ++i) {
+        // prefix every message with the file it belongs to
+        char* line = jobs[i].output;
+        while (line && *line) {
+            char* eol = strchr(line, '\n');
+            int len = eol ? (int)(eol - line) : (int)strlen(line);
+            printf("%s: %.*s\n", jobs[i].file, len, line);
+            line += eol ? len + 1 : len;
+        }
+        free(jobs[i].output);
+
+        if (jobs[i].result == -1) {
+            failed++;
+        } else if (jobs[i].result == 1) {
+            cached++;
+        }
     }
 
-cleanup:
-    fclose(tmp);
+    printf("%d of %d files assembled (%d up to date).\n", nfiles - failed, nfiles, cached);
+
+    free(jobs);
+    return failed ? 1 : 0;
 }
 
 void symbol(const char* cmd)
 {
-    char ch;
-    if (sscanf(cmd, " %c", &ch) == 1) {
+    char ch, arg[10];
+    int cnt = sscanf(cmd, "%9s %c", arg, &ch);
+    if (cnt != EOF && (cnt != 1 || strcmp(arg, "stats") != 0)) {
         printf("Invalid command.\n");
         return;
     }
@@ -881,12 +1668,27 @@ void symbol(const char* cmd)
         return;
     }
 
-    print_symtab_list_sorted(symbols);
+    if (cnt == EOF) {
+        print_symtab_list_sorted(symbols);
+        return;
+    }
+
+    struct symtab_stats stats;
+    symtab_get_stats(symbols, &stats);
+    printf("\tsymbols        %d\n", stats.symbols);
+    printf("\tcapacity       %d\n", stats.capacity);
+    printf("\tresizes        %d\n", stats.resizes);
+    printf("\tlookups        %lld\n", stats.lookups);
+    printf("\tcollisions     %lld\n", stats.collisions);
+    printf("\tlongest probe  %d\n", stats.longest_probe);
+    printf("\tavg. probes    %.2f\n", stats.lookups ? (double)stats.probes / stats.lookups : 0.0);
 }
 
 void free_symbols(void)
 {
     if (symbols) {
         symtab_free(symbols);
+        symbols = NULL;
     }
+    assembly_clear(&last);
 }
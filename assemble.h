@@ -1,7 +1,21 @@
 #ifndef ASSEMBLE_H
 #define ASSEMBLE_H
 
+#include "symtab.h"
+
+#include <stdio.h>
+
 void assemble(const char* cmd);
+
+// assembles file into file.lst and file.obj, the latter in the binary
+// object format if binary is set, filling symbols and printing errors to
+// out; returns -1 on error, 0 on success and 1 if the outputs were already
+// up to date and symbols were filled from file.cache
+int assemble_file(FILE* out, const char* file, symtab symbols, int binary, int nthreads);
+
+// assembles all files in parallel, each with its own symbol table;
+// returns the process exit status
+int assemble_batch(int nfiles, char** files, int binary);
 void symbol(const char* cmd);
 void free_symbols(void);
 
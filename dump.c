@@ -1,25 +1,188 @@
 #include "dump.h"
+#include "jit.h"
+#include "machine.h"
+#include "objbin.h"
+#include "objrec.h"
+#include "parallel.h"
+#include "profile.h"
+#include "snapshot.h"
 #include "symtab.h"
+#include "trace.h"
+#include "undo.h"
 
 #include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define NDEBUG
 
-static unsigned char mem[16 * 65536];
-static int lastAddr = 0;
+struct decoded;
+struct machine;
+typedef int (*handler)(struct machine*, const struct decoded*);
+
+// an instruction decoded from mem[], kept until one of its bytes is
+// written so that loops are not decoded again on every pass
+struct decoded {
+    handler run; // NULL if the opcode is not supported
+    handler op; // handler of this opcode alone, for the threaded engine
+    int disp; // sign-extended
+    unsigned gen; // valid if equal to decode_gen
+    unsigned char opcode;
+    unsigned char nixbpe; // format 3/4 flags as in the instruction
+    unsigned char r1, r2; // format 2 registers
+};
+
+struct write {
+    int addr, len;
+    unsigned char old[3];
+};
+
+struct snapshot {
+    char name[32];
+    struct image* image;
+    struct registers reg;
+    int progAddr;
+    int nbreakpoints;
+    int* breakpoints;
+    struct snapshot* next;
+};
+
+// one SIC/XE computer; the commands work on the console machine, and batch
+// runs give every job a machine of its own
+struct machine {
+    unsigned char mem[MEMORY_SIZE];
+    struct registers reg;
+    int progAddr;
+    int lastAddr;
+
+    // messages of the loader and of a running program
+    FILE* out;
+    // set while the check engine runs an instruction a second time
+    int quiet;
+    // translated code runs against this machine
+    int jit;
+
+    // bytes read by RD so far; the device gives input[] if there is one,
+    // otherwise 100 bytes of FF and then zeros
+    int read_count;
+    const unsigned char* input;
+    int input_len;
+
+    struct decoded decode_cache[MEMORY_SIZE];
+    unsigned decode_gen;
+
+    // one bit per page written since the last reset, and since the last
+    // snapshot was saved or restored
+    unsigned char reset_dirty[MEMORY_SIZE / MEMORY_PAGE / 8];
+    unsigned char snapshot_dirty[MEMORY_SIZE / MEMORY_PAGE / 8];
+
+    int nbreakpoints;
+    int* breakpoints;
+    // one bit per address, so that run can test PC without a scan
+    unsigned char breakpoint_bits[MEMORY_SIZE / 8];
+
+    // writes made while log_writes is set, so that the check engines can
+    // undo them and run the same instructions again
+    int log_writes;
+    int nwrites;
+    struct write writes[JIT_MAX_BLOCK];
+
+    struct snapshot* snapshots;
+    // last snapshot saved or restored, which the next save shares pages with
+    struct snapshot* recent;
+
+    // object files of the last successful load
+    struct profile_source* loaded;
+    int nloaded;
+};
+
+static struct machine* new_machine(FILE* out)
+{
+    struct machine* m = calloc(1, sizeof(struct machine));
+    m->out = out;
+    m->decode_gen = 1;
+    return m;
+}
+
+static void clear_breakpoints(struct machine* m);
+static int execute(struct machine* m, int (*step)(struct machine*), int jit, int check, long long max_steps);
+static void clear_snapshots(struct machine* m);
+
+static void free_machine(struct machine* m)
+{
+    clear_breakpoints(m);
+    clear_snapshots(m);
+    free(m->loaded);
+    free(m);
+}
+
+// the machine that commands typed at sicsim> work on
+static struct machine* console = NULL;
+
+static struct machine* console_machine(void)
+{
+    if (!console) {
+        console = new_machine(stdout);
+    }
+    return console;
+}
+
+void free_console(void)
+{
+    if (console) {
+        free_machine(console);
+        console = NULL;
+    }
+}
+
+// drops decoded instructions that cover a byte in [addr, addr + len)
+static void invalidate_decoded(struct machine* m, int addr, int len)
+{
+    int start = addr > 3 ? addr - 3 : 0;
+    int end = addr + len < (int)sizeof(m->mem) ? addr + len : (int)sizeof(m->mem);
+    for (int i = start; i < end; ++i) {
+        m->decode_cache[i].gen = 0;
+    }
+    if (m->jit) {
+        jit_invalidate(addr, len);
+    }
+}
+
+static void invalidate_all_decoded(struct machine* m)
+{
+    if (++m->decode_gen == 0) {
+        memset(m->decode_cache, 0, sizeof(m->decode_cache));
+        m->decode_gen = 1;
+    }
+    if (m->jit) {
+        jit_flush();
+    }
+}
+
+// called after every change to [addr, addr + len)
+static void mark_written(struct machine* m, int addr, int len)
+{
+    int last = addr + len - 1 < (int)sizeof(m->mem) ? addr + len - 1 : (int)sizeof(m->mem) - 1;
+    for (int page = addr / MEMORY_PAGE; page <= last / MEMORY_PAGE; ++page) {
+        m->reset_dirty[page >> 3] |= 1 << (page & 7);
+        m->snapshot_dirty[page >> 3] |= 1 << (page & 7);
+    }
+    invalidate_decoded(m, addr, len);
+}
 
 void dump(const char* cmd)
 {
+    struct machine* m = console_machine();
     int start, end;
     char ch1, ch2;
     int cnt = sscanf(cmd, "%x %c %x %c", &start, &ch1, &end, &ch2);
 
     if (cnt == EOF) {
-        start = lastAddr;
-        end = lastAddr / 16 * 16 + 160;
+        start = m->lastAddr;
+        end = m->lastAddr / 16 * 16 + 160;
     } else if (cnt == 1) {
         end = start / 16 * 16 + 160;
     } else if (cnt == 3 && ch1 == ',') {
@@ -34,10 +197,10 @@ void dump(const char* cmd)
         return;
     }
 
-    lastAddr = end;
+    m->lastAddr = end;
 
-    if (end > (int)sizeof(mem)) {
-        end = sizeof(mem);
+    if (end > (int)sizeof(m->mem)) {
+        end = sizeof(m->mem);
     }
 
     for (int i = start / 16 * 16; i < (end + 15) / 16 * 16; ++i) {
@@ -46,7 +209,7 @@ void dump(const char* cmd)
         }
 
         if (i >= start && i < end) {
-            printf("%02X ", mem[i]);
+            printf("%02X ", m->mem[i]);
         } else {
             printf("   ");
         }
@@ -56,8 +219,8 @@ void dump(const char* cmd)
 
             int s = i / 16 * 16;
             for (int j = s; j < s + 16; ++j) {
-                if (j >= start && isprint(mem[j])) {
-                    printf("%c", mem[j]);
+                if (j >= start && isprint(m->mem[j])) {
+                    printf("%c", m->mem[j]);
                 } else {
                     printf(".");
                 }
@@ -69,6 +232,7 @@ void dump(const char* cmd)
 
 void edit(const char* cmd)
 {
+    struct machine* m = console_machine();
     int addr, val;
     char ch;
     int cnt = sscanf(cmd, "%x , %x %c", &addr, &val, &ch);
@@ -78,7 +242,7 @@ void edit(const char* cmd)
         return;
     }
 
-    if (addr < 0 || addr >= (int)sizeof(mem)) {
+    if (addr < 0 || addr >= (int)sizeof(m->mem)) {
         puts("Invalid address.");
         return;
     }
@@ -88,11 +252,14 @@ void edit(const char* cmd)
         return;
     }
 
-    mem[addr] = (unsigned char)val;
+    m->mem[addr] = (unsigned char)val;
+    mark_written(m, addr, 1);
+    undo_clear();
 }
 
 void fill(const char* cmd)
 {
+    struct machine* m = console_machine();
     int start, end, val;
     char ch;
     int cnt = sscanf(cmd, "%x , %x , %x %c", &start, &end, &val, &ch);
@@ -109,7 +276,7 @@ void fill(const char* cmd)
 
     end = end + 1;
 
-    if (end > (int)sizeof(mem) || start >= (int)sizeof(mem) || end <= start) {
+    if (end > (int)sizeof(m->mem) || start >= (int)sizeof(m->mem) || end <= start) {
         puts("Invalid range");
         return;
     }
@@ -120,36 +287,36 @@ void fill(const char* cmd)
     }
 
     for (int i = start; i < end; ++i) {
-        mem[i] = (unsigned char)val;
+        m->mem[i] = (unsigned char)val;
     }
+    mark_written(m, start, end - start);
+    undo_clear();
 }
 
 void reset(const char* cmd)
 {
+    struct machine* m = console_machine();
     char ch;
     if (sscanf(cmd, " %c", &ch) == 1) {
         puts("Invalid command.");
         return;
     }
 
-    memset(mem, 0, sizeof(mem));
+    // pages never written since the last reset are still zero
+    for (int page = 0; page < (int)sizeof(m->mem) / MEMORY_PAGE; ++page) {
+        if (m->reset_dirty[page >> 3] >> (page & 7) & 1) {
+            memset(m->mem + page * MEMORY_PAGE, 0, MEMORY_PAGE);
+            m->snapshot_dirty[page >> 3] |= 1 << (page & 7);
+        }
+    }
+    memset(m->reset_dirty, 0, sizeof(m->reset_dirty));
+    invalidate_all_decoded(m);
+    undo_clear();
 }
 
-static int progAddr = 0;
-struct registers {
-    int A;
-    int X;
-    int L;
-    int PC;
-    int B;
-    int S;
-    int T;
-    int SW;
-};
-static struct registers reg = { 0, 0, 0, 0, 0, 0, 0, 0 };
-
 void progaddr(const char* cmd)
 {
+    struct machine* m = console_machine();
     int addr;
     char ch;
     int cnt = sscanf(cmd, "%x %c", &addr, &ch);
@@ -159,177 +326,270 @@ void progaddr(const char* cmd)
         return;
     }
 
-    if (addr < 0 || addr >= (int)sizeof(mem)) {
+    if (addr < 0 || addr >= (int)sizeof(m->mem)) {
         puts("Invalid address");
         return;
     }
 
-    progAddr = addr;
+    m->progAddr = addr;
 }
 
-struct extdef {
-    char name[10];
-    int addr;
-};
-
-struct extref {
-    char name[10];
-    int idx;
-};
-
-struct textrec {
-    unsigned char text[32];
-    int addr, len;
-};
-
+// modification record kept until every section has been read; the
+// length field is not needed since a whole word is always patched
 struct modify {
-    int addr, len, idx;
-    int sign;
+    int addr;
+    short idx;
+    short sign;
 };
 
 struct sect {
     char name[10];
-    int length;
+    // the section was assembled at start and is loaded at addr
+    int addr, start, length;
     int nrefs;
-    struct extref* refs;
+    struct objrec_ref* refs;
     int ndefs;
-    struct extdef* defs;
-    int ntextrecs;
-    struct textrec* textrecs;
-    int nmodify;
+    struct objrec_def* defs;
+    int nmodify, capmodify;
     struct modify* modifys;
     int entry;
+
+    // the bytes of the section, which start as a copy of the memory at
+    // addr so that bytes no text record sets are left as they were
+    unsigned char* image;
+
+    // one of them open from the header until the rest has been read
+    FILE* fp;
+    struct objbin bin;
+    // messages of parse_obj, which may run on another thread
+    char* output;
+    size_t size;
+    int result;
 };
 
-static int parse_obj(const char* filename, struct sect* sect)
+// opens an object file of either format and reads its header, placing
+// the section at csaddr and copying the memory there into its image;
+// mem is only read
+static int open_obj(FILE* out, const char* filename, struct sect* sect, const unsigned char* mem, int csaddr)
 {
-    FILE* fp = fopen(filename, "r");
-    if (!fp) {
-        printf("Error: error opening file %s\n", filename);
-        return -1;
-    }
-
-    if (fscanf(fp, "H%6s", sect->name) != 1) {
-        printf("Error: error parsing program name\n");
-        return -1;
-    }
-
-    if (fscanf(fp, "%x ", &sect->length) != 1) {
-        printf("Error: error parsing program length\n");
-        return -1;
-    }
-
-    char line[256];
-
+    sect->addr = csaddr;
     sect->nrefs = 0;
     sect->refs = NULL;
     sect->ndefs = 0;
     sect->defs = NULL;
-    sect->ntextrecs = 0;
-    sect->textrecs = NULL;
     sect->nmodify = 0;
+    sect->capmodify = 0;
     sect->modifys = NULL;
     sect->entry = -1;
+    sect->image = NULL;
+    sect->output = NULL;
+    sect->size = 0;
+    sect->fp = NULL;
+
+    int kind = objbin_open(filename, &sect->bin);
+    if (kind == 0) {
+        strcpy(sect->name, sect->bin.header->name);
+        sect->start = sect->bin.header->start;
+        sect->length = sect->bin.header->length;
+        if (sect->bin.header->entry != OBJBIN_NONE) {
+            sect->entry = sect->bin.header->entry;
+        }
+    } else if (kind == -2) {
+        fprintf(out, "Error: %s is not a valid binary object file\n", filename);
+        return -1;
+    } else {
+        sect->fp = kind == 1 ? fopen(filename, "r") : NULL;
+        if (!sect->fp) {
+            fprintf(out, "Error: error opening file %s\n", filename);
+            return -1;
+        }
+
+        char line[32];
+        struct objrec_header header;
+        if (!fgets(line, sizeof(line), sect->fp) || objrec_header(line, &header) == -1) {
+            fprintf(out, "Error: cannot parse header record\n");
+            return -1;
+        }
+        strcpy(sect->name, header.name);
+        sect->start = header.start;
+        sect->length = header.length;
+    }
+
+    if ((unsigned)sect->length > MEMORY_SIZE || (long long)csaddr + sect->length > MEMORY_SIZE) {
+        fprintf(out, "Error: Invalid load address\n");
+        return -1;
+    }
+    sect->image = malloc(sect->length ? sect->length : 1);
+    memcpy(sect->image, mem + csaddr, sect->length);
+    return 0;
+}
 
-    while (fgets(line, 256, fp)) {
+// reads the records after the header, writing text records straight
+// into the image and keeping the rest in sect
+static int parse_obj(FILE* out, struct sect* sect)
+{
+    // long enough for a text record of 255 bytes
+    char line[1024];
+
+    while (fgets(line, sizeof(line), sect->fp)) {
         if (line[0] == 'R') {
-            sect->nrefs = (int)((strlen(line) - 2 + 7) / 8);
-            sect->refs = malloc(sizeof(struct extref) * sect->nrefs);
-            int n = 1;
-            for (int i = 0; i < sect->nrefs; ++i) {
-                int m;
-                if (sscanf(line + n, "%2x%6s%n", &sect->refs[i].idx, sect->refs[i].name, &m) != 2) {
-                    printf("Error: cannot parse external reference record\n");
-                    return -1;
-                }
-                n += m;
+            if (objrec_refs(line, &sect->refs, &sect->nrefs) == -1) {
+                fprintf(out, "Error: cannot parse external reference record\n");
+                return -1;
             }
         } else if (line[0] == 'D') {
-            sect->ndefs = (int)((strlen(line) - 2 + 11) / 12);
-            sect->defs = malloc(sizeof(struct extdef) * sect->ndefs);
-            int n = 1;
-            for (int i = 0; i < sect->ndefs; ++i) {
-                int m;
-                if (sscanf(line + n, "%6s%6x%n", sect->defs[i].name, &sect->defs[i].addr, &m) != 2) {
-                    printf("Error: cannot parse external definition record\n");
-                    return -1;
-                }
-                n += m;
+            if (objrec_defs(line, &sect->defs, &sect->ndefs) == -1) {
+                fprintf(out, "Error: cannot parse external definition record\n");
+                return -1;
             }
         } else if (line[0] == 'T') {
-            int n = 9, i = 0;
-            int hex;
-            struct textrec curr;
+            int addr, len;
 
-            if (sscanf(line + 1, "%6x%2x", &curr.addr, &curr.len) != 2) {
-                printf("Error: cannot parse text record\n");
+            if (objrec_text(line, &addr, &len) == -1) {
+                fprintf(out, "Error: cannot parse text record\n");
                 return -1;
             }
-
-            while (sscanf(line + n, "%2x", &hex) == 1) {
-                curr.text[i++] = hex & 0xff;
-                n += 2;
+            if (addr < sect->start || addr - sect->start + len > sect->length) {
+                fprintf(out, "Error: text record outside of section %s\n", sect->name);
+                return -1;
+            }
+            if (objrec_bytes(line + OBJREC_TEXT, len, sect->image + addr - sect->start) == -1) {
+                fprintf(out, "Error: cannot parse text record\n");
+                return -1;
             }
-
-            // grow text record array
-            sect->ntextrecs++;
-            sect->textrecs = realloc(sect->textrecs, sizeof(struct textrec) * sect->ntextrecs);
-            sect->textrecs[sect->ntextrecs - 1] = curr;
 
         } else if (line[0] == 'M') {
-            struct modify curr;
-
-            if (sscanf(line + 1, "%6x%2x+%2x", &curr.addr, &curr.len, &curr.idx) == 3) {
-                curr.sign = 1;
-            } else if (sscanf(line + 1, "%6x%2x-%2x", &curr.addr, &curr.len, &curr.idx) == 3) {
-                curr.sign = -1;
-            } else {
-                printf("Error: cannot parse modification record\n");
+            struct objrec_modify curr;
+
+            if (objrec_modify(line, &curr) == -1) {
+                fprintf(out, "Error: cannot parse modification record\n");
+                return -1;
+            }
+            if (curr.addr < sect->start || curr.addr - sect->start + 3 > sect->length) {
+                fprintf(out, "Error: modification record outside of section %s\n", sect->name);
                 return -1;
             }
 
-            sect->nmodify++;
-            sect->modifys = realloc(sect->modifys, sizeof(struct modify) * sect->nmodify);
-            sect->modifys[sect->nmodify - 1] = curr;
+            if (sect->nmodify == sect->capmodify) {
+                sect->capmodify = sect->capmodify ? sect->capmodify * 2 : 16;
+                sect->modifys = realloc(sect->modifys, sizeof(struct modify) * sect->capmodify);
+            }
+            sect->modifys[sect->nmodify++] = (struct modify) { curr.addr, (short)curr.idx, (short)curr.sign };
 
         } else if (line[0] == 'E') {
-            sscanf(line + 1, "%6x", &sect->entry);
+            if (objrec_end(line, &sect->entry) == -1) {
+                fprintf(out, "Error: cannot parse end record\n");
+                return -1;
+            }
         }
     }
-
-    fclose(fp);
     return 0;
 }
 
+// copies a binary object file, which objbin_open has checked, into sect
+// and its segments into the image
+static void read_objbin(struct sect* sect)
+{
+    const struct objbin* bin = &sect->bin;
+    const struct objbin_header* h = bin->header;
+
+    for (uint32_t i = 0; i < h->nsegments; ++i) {
+        const struct objbin_segment* seg = &bin->segments[i];
+        memcpy(sect->image + seg->addr - sect->start, bin->text + seg->offset, seg->len);
+    }
+
+    sect->ndefs = h->ndefs;
+    sect->defs = malloc(sizeof(struct objrec_def) * (h->ndefs ? h->ndefs : 1));
+    for (uint32_t i = 0; i < h->ndefs; ++i) {
+        strcpy(sect->defs[i].name, bin->defs[i].name);
+        sect->defs[i].addr = bin->defs[i].value;
+    }
+    sect->nrefs = h->nrefs;
+    sect->refs = malloc(sizeof(struct objrec_ref) * (h->nrefs ? h->nrefs : 1));
+    for (uint32_t i = 0; i < h->nrefs; ++i) {
+        strcpy(sect->refs[i].name, bin->refs[i].name);
+        sect->refs[i].idx = bin->refs[i].value;
+    }
+    sect->nmodify = sect->capmodify = h->nmodify;
+    sect->modifys = malloc(sizeof(struct modify) * (h->nmodify ? h->nmodify : 1));
+    for (uint32_t i = 0; i < h->nmodify; ++i) {
+        sect->modifys[i] = (struct modify) { bin->modifys[i].addr, bin->modifys[i].idx, bin->modifys[i].sign };
+    }
+}
+
+static void parse_obj_job(void* arg, int i)
+{
+    struct sect* sect = (struct sect*)arg + i;
+
+    if (sect->bin.map) {
+        read_objbin(sect);
+        objbin_close(&sect->bin);
+        sect->result = 0;
+        return;
+    }
+
+    // messages are printed in file order once every file is read
+    FILE* out = open_memstream(&sect->output, &sect->size);
+    sect->result = parse_obj(out ? out : stdout, sect);
+    if (out) {
+        fclose(out);
+    }
+    fclose(sect->fp);
+    sect->fp = NULL;
+}
+
 static void free_obj(struct sect* prog)
 {
+    if (prog->fp) {
+        fclose(prog->fp);
+    }
+    objbin_close(&prog->bin);
     free(prog->refs);
     free(prog->defs);
-    free(prog->textrecs);
     free(prog->modifys);
+    free(prog->image);
+    free(prog->output);
 }
 
-void loader(const char* cmd)
+// loads cnt object files at progAddr and links them, reading the files
+// on up to nthreads threads
+static int load(struct machine* m, int cnt, char (*files)[100], int nthreads)
 {
-    char files[3][100];
-    int cnt = sscanf(cmd, "%99s %99s %99s", files[0], files[1], files[2]);
-    if (cnt == 0 || cnt == EOF) {
-        puts("Error: Invalid command\n");
-        return;
-    }
-
+    int result = -1;
     symtab tab = symtab_init();
     struct sect* sects = malloc(sizeof(struct sect) * cnt);
+    int nsects = 0;
+    m->nloaded = 0;
+
+    // the headers place every section after the previous one; memory is
+    // not written until every file has been read and relocated, so a bad
+    // file leaves it as it was
+    int csaddr = m->progAddr;
+    for (int i = 0; i < cnt; ++i) {
+        ++nsects;
+        if (open_obj(m->out, files[i], &sects[i], m->mem, csaddr) == -1) {
+            goto cleanup;
+        }
+        csaddr += sects[i].length;
+    }
+
+    // so the files can be read at once, each into its own image
+    parallel_for(cnt, nthreads, parse_obj_job, sects);
 
-    // first pass
-    int csaddr = progAddr;
     for (int i = 0; i < cnt; ++i) {
-        if (parse_obj(files[i], &sects[i]) == -1) {
+        if (sects[i].output) {
+            fputs(sects[i].output, m->out);
+        }
+        if (sects[i].result == -1) {
             goto cleanup;
         }
+    }
+
+    for (int i = 0; i < cnt; ++i) {
+        csaddr = sects[i].addr;
 
         if (symtab_find(tab, sects[i].name) != -1) {
-            printf("Error: Control section '%s' already exists\n", sects[i].name);
+            fprintf(m->out, "Error: Control section '%s' already exists\n", sects[i].name);
             goto cleanup;
         }
 
@@ -337,113 +597,186 @@ void loader(const char* cmd)
 
         for (int j = 0; j < sects[i].ndefs; ++j) {
             if (symtab_find(tab, sects[i].defs[j].name) != -1) {
-                printf("Error: Duplicate external symbol '%s'\n", sects[i].defs[j].name);
+                fprintf(m->out, "Error: Duplicate external symbol '%s'\n", sects[i].defs[j].name);
                 goto cleanup;
             }
-            symtab_insert(tab, sects[i].defs[j].name, csaddr + sects[i].defs[j].addr);
+            symtab_insert(tab, sects[i].defs[j].name, csaddr + sects[i].defs[j].addr - sects[i].start);
         }
-
-        csaddr += sects[i].length;
-    }
-
-    if (csaddr > (int)sizeof(mem)) {
-        printf("Error: Invalid load address\n");
-        goto cleanup;
     }
 
-    // second pass
-    csaddr = progAddr;
-    reg.PC = progAddr;
-    puts("control   symbol    address   length");
-    puts("secion    name");
-    puts("-------------------------------------");
-
+    // the external symbol table is complete, so relocate
+    int pc = m->progAddr;
     for (int i = 0; i < cnt; ++i) {
-
-        printf("%-10s%-10s%04X%6s%04X\n", sects[i].name, "", csaddr, "", sects[i].length);
-
-        for (int j = 0; j < sects[i].ntextrecs; ++j) {
-            memcpy(mem + csaddr + sects[i].textrecs[j].addr,
-                sects[i].textrecs[j].text, sects[i].textrecs[j].len);
+        csaddr = sects[i].addr;
+
+        // what every reference number adds, INT_MIN if it has none; 01
+        // moves the control section from where it was assembled unless
+        // the R record says otherwise
+        int refs[256];
+        for (int k = 0; k < 256; ++k) {
+            refs[k] = INT_MIN;
+        }
+        refs[0x01] = csaddr - sects[i].start;
+        // backwards so that the first of two equal numbers wins
+        for (int k = sects[i].nrefs - 1; k >= 0; --k) {
+            int addr = symtab_find(tab, sects[i].refs[k].name);
+            refs[sects[i].refs[k].idx] = addr == -1 ? INT_MIN : addr;
         }
 
         for (int j = 0; j < sects[i].nmodify; ++j) {
-            int offset = csaddr + sects[i].modifys[j].addr;
-            int orig = mem[offset] << 16 | mem[offset + 1] << 8 | mem[offset + 2];
-            int val = -1;
+            const struct modify* mod = &sects[i].modifys[j];
+            unsigned char* word = sects[i].image + mod->addr - sects[i].start;
+            int orig = word[0] << 16 | word[1] << 8 | word[2];
+            int val = refs[mod->idx];
 
-            // reference number 01 = control section name
-            if (sects[i].modifys[j].idx == 0x01) {
-                val = csaddr;
-            }
-            for (int k = 0; k < sects[i].nrefs; ++k) {
-                if (sects[i].refs[k].idx == sects[i].modifys[j].idx) {
-                    val = symtab_find(tab, sects[i].refs[k].name);
-                    break;
-                }
-            }
-            if (val == -1) {
-                printf("Error: cannot find reference #%d\n", sects[i].modifys[j].idx);
+            if (val == INT_MIN) {
+                fprintf(m->out, "Error: cannot find reference #%d\n", mod->idx);
                 goto cleanup;
             }
-            orig += sects[i].modifys[j].sign * val;
-            mem[offset] = (orig >> 16) & 0xff;
-            mem[offset + 1] = (orig >> 8) & 0xff;
-            mem[offset + 2] = orig & 0xff;
-        }
-
-        for (int j = 0; j < sects[i].ndefs; ++j) {
-            printf("%-10s%-10s%04X\n", "", sects[i].defs[j].name, csaddr + sects[i].defs[j].addr);
+            orig += mod->sign * val;
+            word[0] = (orig >> 16) & 0xff;
+            word[1] = (orig >> 8) & 0xff;
+            word[2] = orig & 0xff;
         }
 
         if (sects[i].entry != -1) {
-            reg.PC = csaddr + sects[i].entry;
+            pc = csaddr + sects[i].entry - sects[i].start;
         }
+    }
 
-        csaddr += sects[i].length;
+    for (int i = 0; i < cnt; ++i) {
+        memcpy(m->mem + sects[i].addr, sects[i].image, sects[i].length);
+        mark_written(m, sects[i].addr, sects[i].length);
+    }
+    m->reg.PC = pc;
+
+    fputs("control   symbol    address   length\n", m->out);
+    fputs("secion    name\n", m->out);
+    fputs("-------------------------------------\n", m->out);
+    for (int i = 0; i < cnt; ++i) {
+        fprintf(m->out, "%-10s%-10s%04X%6s%04X\n", sects[i].name, "", sects[i].addr, "", sects[i].length);
+        for (int j = 0; j < sects[i].ndefs; ++j) {
+            fprintf(m->out, "%-10s%-10s%04X\n", "", sects[i].defs[j].name,
+                sects[i].addr + sects[i].defs[j].addr - sects[i].start);
+        }
     }
+    fputs("-------------------------------------\n", m->out);
+    fprintf(m->out, "                 total length %04X\n", csaddr + sects[cnt - 1].length - m->progAddr);
 
-    puts("-------------------------------------");
-    printf("                 total length %04X\n", csaddr - progAddr);
+    // remembered so that run --profile can find the listings
+    m->loaded = realloc(m->loaded, sizeof(struct profile_source) * cnt);
+    for (int i = 0; i < cnt; ++i) {
+        strcpy(m->loaded[i].file, files[i]);
+        m->loaded[i].addr = sects[i].addr;
+        m->loaded[i].length = sects[i].length;
+    }
+    m->nloaded = cnt;
+    result = 0;
 
 cleanup:
-    for (int i = 0; i < cnt; ++i) {
+    for (int i = 0; i < nsects; ++i) {
         free_obj(&sects[i]);
     }
     free(sects);
 
     symtab_free(tab);
+    return result;
+}
+
+// appends word to the object files, or for "@file" the names listed in
+// that file, separated by white space
+static int add_files(FILE* out, const char* word, char (**files)[100], int* n)
+{
+    if (word[0] != '@') {
+        *files = realloc(*files, sizeof(**files) * (*n + 1));
+        strcpy((*files)[(*n)++], word);
+        return 0;
+    }
+
+    FILE* fp = fopen(word + 1, "r");
+    if (!fp) {
+        fprintf(out, "Error: error opening file %s\n", word + 1);
+        return -1;
+    }
+    char name[100];
+    while (fscanf(fp, "%99s", name) == 1) {
+        *files = realloc(*files, sizeof(**files) * (*n + 1));
+        strcpy((*files)[(*n)++], name);
+    }
+    fclose(fp);
+    return 0;
+}
+
+void loader(const char* cmd)
+{
+    char (*files)[100] = NULL;
+    char word[100];
+    int cnt = 0, n;
+    while (sscanf(cmd, "%99s%n", word, &n) == 1) {
+        cmd += n;
+        if (add_files(stdout, word, &files, &cnt) == -1) {
+            free(files);
+            return;
+        }
+    }
+    if (cnt == 0) {
+        puts("Error: Invalid command\n");
+        free(files);
+        return;
+    }
+
+    load(console_machine(), cnt, files, parallel_threads());
+    undo_clear();
+    free(files);
 }
 
-static int nbreakpoints = 0;
-static int* breakpoints = NULL;
+static int is_breakpoint(struct machine* m, int addr)
+{
+    if (addr < 0 || addr >= (int)sizeof(m->mem)) {
+        // out of range breakpoints are only kept in the list
+        for (int i = 0; i < m->nbreakpoints; ++i) {
+            if (m->breakpoints[i] == addr) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    return m->breakpoint_bits[addr >> 3] >> (addr & 7) & 1;
+}
 
 void breakpoint(const char* cmd)
 {
+    struct machine* m = console_machine();
     int addr;
     char ch;
     int cnt = sscanf(cmd, "%x %c", &addr, &ch);
     if (cnt == 1) {
-        if (addr < 0 || addr >= (int)sizeof(mem)) {
+        if (addr < 0 || addr >= (int)sizeof(m->mem)) {
             printf("Error: Address out of range\n");
         }
 
-        nbreakpoints++;
-        breakpoints = realloc(breakpoints, sizeof(int) * nbreakpoints);
-        breakpoints[nbreakpoints - 1] = addr;
+        m->nbreakpoints++;
+        m->breakpoints = realloc(m->breakpoints, sizeof(int) * m->nbreakpoints);
+        m->breakpoints[m->nbreakpoints - 1] = addr;
+        if (addr >= 0 && addr < (int)sizeof(m->mem)) {
+            m->breakpoint_bits[addr >> 3] |= 1 << (addr & 7);
+        }
+
+        // translated blocks run past addresses that were not breakpoints
+        jit_flush();
 
         printf("\t[ok] create breakpoint %04X\n", addr);
     } else if (cnt == EOF) {
         printf("\tbreakpoint\n");
         printf("\t----------\n");
-        for (int i = 0; i < nbreakpoints; ++i) {
-            printf("\t%04X\n", breakpoints[i]);
+        for (int i = 0; i < m->nbreakpoints; ++i) {
+            printf("\t%04X\n", m->breakpoints[i]);
         }
     } else {
         char clear[10];
         cnt = sscanf(cmd, "%9s %c", clear, &ch);
         if (cnt == 1 && strcmp(clear, "clear") == 0) {
-            free_breakpoints();
+            clear_breakpoints(m);
             printf("\t[ok] clear all breakpoints\n");
         } else {
             printf("Error: Invalid command\n");
@@ -452,29 +785,161 @@ void breakpoint(const char* cmd)
     }
 }
 
-void free_breakpoints()
+static void clear_breakpoints(struct machine* m)
+{
+    for (int i = 0; i < m->nbreakpoints; ++i) {
+        if (m->breakpoints[i] >= 0 && m->breakpoints[i] < (int)sizeof(m->mem)) {
+            m->breakpoint_bits[m->breakpoints[i] >> 3] = 0;
+        }
+    }
+    m->nbreakpoints = 0;
+    free(m->breakpoints);
+    m->breakpoints = NULL;
+}
+
+static struct snapshot* find_snapshot(struct machine* m, const char* name)
 {
-    nbreakpoints = 0;
-    free(breakpoints);
-    breakpoints = NULL;
+    for (struct snapshot* s = m->snapshots; s; s = s->next) {
+        if (strcmp(s->name, name) == 0) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void snapshot_save(struct machine* m, const char* name)
+{
+    struct image* image = image_capture(m->mem, sizeof(m->mem), m->recent ? m->recent->image : NULL, m->snapshot_dirty);
+    memset(m->snapshot_dirty, 0, sizeof(m->snapshot_dirty));
+
+    struct snapshot* s = find_snapshot(m, name);
+    if (!s) {
+        s = calloc(1, sizeof(struct snapshot));
+        strcpy(s->name, name);
+        s->next = m->snapshots;
+        m->snapshots = s;
+    }
+    image_free(s->image);
+    free(s->breakpoints);
+
+    s->image = image;
+    s->reg = m->reg;
+    s->progAddr = m->progAddr;
+    s->nbreakpoints = m->nbreakpoints;
+    s->breakpoints = malloc(sizeof(int) * (m->nbreakpoints ? m->nbreakpoints : 1));
+    memcpy(s->breakpoints, m->breakpoints, sizeof(int) * m->nbreakpoints);
+    m->recent = s;
+
+    printf("\t[ok] save snapshot %s, %d KB of new pages\n", name, image_private_bytes(image) / 1024);
+}
+
+static void page_restored(void* m, int addr, int len)
+{
+    mark_written(m, addr, len);
+}
+
+static void snapshot_restore(struct machine* m, const char* name)
+{
+    struct snapshot* s = find_snapshot(m, name);
+    if (!s) {
+        printf("Error: no snapshot named %s\n", name);
+        return;
+    }
+
+    image_restore(s->image, m->mem, m->recent ? m->recent->image : NULL, m->snapshot_dirty, page_restored, m);
+    memset(m->snapshot_dirty, 0, sizeof(m->snapshot_dirty));
+    m->reg = s->reg;
+    m->progAddr = s->progAddr;
+
+    clear_breakpoints(m);
+    m->nbreakpoints = s->nbreakpoints;
+    m->breakpoints = malloc(sizeof(int) * (m->nbreakpoints ? m->nbreakpoints : 1));
+    memcpy(m->breakpoints, s->breakpoints, sizeof(int) * m->nbreakpoints);
+    for (int i = 0; i < m->nbreakpoints; ++i) {
+        if (m->breakpoints[i] >= 0 && m->breakpoints[i] < (int)sizeof(m->mem)) {
+            m->breakpoint_bits[m->breakpoints[i] >> 3] |= 1 << (m->breakpoints[i] & 7);
+        }
+    }
+    jit_flush();
+
+    // the undo log leads back from the state before the restore
+    undo_clear();
+    m->recent = s;
+
+    printf("\t[ok] restore snapshot %s\n", name);
+}
+
+void snapshot(const char* cmd)
+{
+    struct machine* m = console_machine();
+    char ch, what[10], name[32];
+    int cnt = sscanf(cmd, "%9s %31s %c", what, name, &ch);
+    if (cnt == EOF) {
+        printf("\tsnapshot\n");
+        printf("\t--------\n");
+        for (struct snapshot* s = m->snapshots; s; s = s->next) {
+            printf("\t%s\n", s->name);
+        }
+    } else if (cnt == 2 && strcmp(what, "save") == 0) {
+        snapshot_save(m, name);
+    } else if (cnt == 2 && strcmp(what, "restore") == 0) {
+        snapshot_restore(m, name);
+    } else {
+        printf("Invalid command.\n");
+    }
+}
+
+static void clear_snapshots(struct machine* m)
+{
+    while (m->snapshots) {
+        struct snapshot* s = m->snapshots;
+        m->snapshots = s->next;
+        image_free(s->image);
+        free(s->breakpoints);
+        free(s);
+    }
+    m->recent = NULL;
 }
 
-static void print_registers()
+static void report(struct machine* m, const char* fmt, ...)
 {
-    printf("\tA : %06X X : %06X\n", reg.A & 0xffffff, reg.X & 0xffffff);
-    printf("\tL : %06X PC: %06X\n", reg.L & 0xffffff, reg.PC & 0xffffff);
-    printf("\tB : %06X S : %06X\n", reg.B & 0xffffff, reg.S & 0xffffff);
-    printf("\tT : %06X\n", reg.T & 0xffffff);
+    if (m->quiet) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(m->out, fmt, ap);
+    va_end(ap);
+}
+
+static void log_write(struct machine* m, int addr, int len)
+{
+    if (m->log_writes && m->nwrites < JIT_MAX_BLOCK) {
+        struct write* w = &m->writes[m->nwrites++];
+        w->addr = addr;
+        w->len = len;
+        memcpy(w->old, m->mem + addr, len);
+    }
+}
+
+static void print_registers(struct machine* m)
+{
+    fprintf(m->out, "\tA : %06X X : %06X\n", m->reg.A & 0xffffff, m->reg.X & 0xffffff);
+    fprintf(m->out, "\tL : %06X PC: %06X\n", m->reg.L & 0xffffff, m->reg.PC & 0xffffff);
+    fprintf(m->out, "\tB : %06X S : %06X\n", m->reg.B & 0xffffff, m->reg.S & 0xffffff);
+    fprintf(m->out, "\tT : %06X\n", m->reg.T & 0xffffff);
 }
 
-static int set_memory(int addr, int val)
+static int set_memory(struct machine* m, int addr, int val)
 {
-    if (addr < 0 || addr >= (int)sizeof(mem)) {
+    if (addr < 0 || addr >= (int)sizeof(m->mem)) {
         return -1;
     }
-    mem[addr] = (val >> 16) & 0xff;
-    mem[addr + 1] = (val >> 8) & 0xff;
-    mem[addr + 2] = val & 0xff;
+    log_write(m, addr, 3);
+    m->mem[addr] = (val >> 16) & 0xff;
+    m->mem[addr + 1] = (val >> 8) & 0xff;
+    m->mem[addr + 2] = val & 0xff;
+    mark_written(m, addr, 3);
 
 #ifndef NDEBUG
     printf("set memory at %06X to %06X\n", addr, val);
@@ -482,33 +947,35 @@ static int set_memory(int addr, int val)
     return 0;
 }
 
-static int* get_register(int n)
+static int* get_register(struct machine* m, int n)
 {
     switch (n) {
     case 0:
-        return &reg.A;
+        return &m->reg.A;
     case 1:
-        return &reg.X;
+        return &m->reg.X;
     case 2:
-        return &reg.L;
+        return &m->reg.L;
     case 8:
-        return &reg.PC;
+        return &m->reg.PC;
     case 9:
         return NULL; // SW
     case 3:
-        return &reg.B;
+        return &m->reg.B;
     case 4:
-        return &reg.S;
+        return &m->reg.S;
     case 5:
-        return &reg.T;
+        return &m->reg.T;
     case 6:
         return NULL; // F
     }
     return NULL;
 }
 
-static int run_format_1()
+static int run_format_1(struct machine* m, const struct decoded* d)
 {
+    (void)m;
+    (void)d;
     return -1;
 }
 
@@ -517,16 +984,14 @@ static int compare(int a, int b)
     return a < b ? -1 : (a == b ? 0 : 1);
 }
 
-static int run_format_2()
+// register operands of a format 2 instruction, which is then skipped
+static int format_2_operands(struct machine* m, const struct decoded* d, int** r1, int** r2)
 {
-    int opcode = mem[reg.PC] & 0xfc;
-    int r1 = (mem[reg.PC + 1] >> 4) & 0x0f;
-    int r2 = mem[reg.PC + 1] & 0x0f;
-    int* p1 = get_register(r1);
-    int* p2 = get_register(r2);
+    int* p1 = get_register(m, d->r1);
+    int* p2 = get_register(m, d->r2);
 
     if (!p1 || !p2) {
-        printf("Error: Invalid register.\n");
+        report(m, "Error: Invalid register.\n");
         return -1;
     }
 
@@ -538,9 +1003,21 @@ static int run_format_2()
         *p2 |= 0xff000000;
     }
 
-    reg.PC += 2;
+    m->reg.PC += 2;
+
+    *r1 = p1;
+    *r2 = p2;
+    return 0;
+}
+
+static int run_format_2(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
+        return -1;
+    }
 
-    switch (opcode) {
+    switch (d->opcode) {
     // ADDR
     case 0x90:
         *p2 = *p2 + *p1;
@@ -553,7 +1030,7 @@ static int run_format_2()
 
     // COMPR
     case 0xa0:
-        reg.SW = compare(*p1, *p2);
+        m->reg.SW = compare(*p1, *p2);
         break;
 
     // DIVR
@@ -590,98 +1067,84 @@ static int run_format_2()
 
     // TIXR
     case 0xb8:
-        reg.X++;
-        reg.SW = compare(reg.X, *p1);
+        m->reg.X++;
+        m->reg.SW = compare(m->reg.X, *p1);
         break;
     }
     return 0;
 }
 
-static int read_count = 0;
+// next byte of the input device, 0 once it runs out
+static int read_device(struct machine* m)
+{
+    if (m->input) {
+        return m->read_count < m->input_len ? m->input[m->read_count++] : 0;
+    }
+    if (m->read_count < 100) {
+        m->read_count++;
+        return 0xff;
+    }
+    return 0;
+}
 
-static int run_format_3_4()
+// target address and operand value of a format 3/4 instruction, which is
+// then skipped
+static int format_3_4_operand(struct machine* m, const struct decoded* d, int* target, int* value)
 {
-    int opcode = mem[reg.PC] & 0xfc;
     int n, i, x, b, p, e, disp, val, addr;
-    n = (mem[reg.PC] & 0x02) != 0;
-    i = (mem[reg.PC] & 0x01) != 0;
+    n = (d->nixbpe & 0x20) != 0;
+    i = (d->nixbpe & 0x10) != 0;
 
     if (!n && !i) {
 
-        printf("Error: SIC compat instruction\n");
+        report(m, "Error: SIC compat instruction\n");
         return -1;
 
-        /*
-        x = (mem[reg.PC + 1] & 0x80) != 0;
-        b = p = e = 0;
-        disp = (mem[reg.PC + 1] & 0x7f) << 8 | mem[reg.PC + 2];
-        addr = disp;
+    } else {
+        x = (d->nixbpe & 0x08) != 0;
+        b = (d->nixbpe & 0x04) != 0;
+        p = (d->nixbpe & 0x02) != 0;
+        e = (d->nixbpe & 0x01) != 0;
 
-        reg.PC += 3;
+        disp = d->disp;
+        m->reg.PC += e ? 4 : 3;
 
-        if (addr < 0 || addr >= (int)sizeof(mem)) {
-            printf("Error: Address out of range\n");
-            return -1;
-        }
-        val = mem[addr];
-        */
+        addr = disp;
 
-    } else {
-        x = (mem[reg.PC + 1] & 0x80) != 0;
-        b = (mem[reg.PC + 1] & 0x40) != 0;
-        p = (mem[reg.PC + 1] & 0x20) != 0;
-        e = (mem[reg.PC + 1] & 0x10) != 0;
-
-        if (e == 0) {
-            disp = (mem[reg.PC + 1] & 0x0f) << 8 | mem[reg.PC + 2];
-            if (disp & 0x800) {
-                disp |= 0xfffff000;
-            }
-            reg.PC += 3;
-        } else {
-            disp = (mem[reg.PC + 1] & 0x0f) << 16 | mem[reg.PC + 2] << 8 | mem[reg.PC + 3];
-            if (disp & 0x80000) {
-                disp |= 0xfff00000;
+        if (x) {
+            if (m->reg.X & 0x800000) {
+                m->reg.X |= 0xff000000;
             }
-            reg.PC += 4;
-        }
-
-        addr = disp;
-
-        if (x) {
-            if (reg.X & 0x800000) {
-                reg.X |= 0xff000000;
-            }
-            addr += reg.X;
+            addr += m->reg.X;
         }
 
         if (p) {
-            addr += reg.PC;
+            addr += m->reg.PC;
         }
 
         if (b) {
-            addr += reg.B;
+            addr += m->reg.B;
         }
 
         if (n && i) {
             // simple addressing
-            if (addr < 0 || addr >= (int)sizeof(mem)) {
-                printf("Error: Address out of range\n");
+            if (addr < 0 || addr >= (int)sizeof(m->mem)) {
+                report(m, "Error: Address out of range\n");
                 return -1;
             }
-            val = (mem[addr] << 16) | (mem[addr + 1] << 8) | mem[addr + 2];
+            val = (m->mem[addr] << 16) | (m->mem[addr + 1] << 8) | m->mem[addr + 2];
         } else if (n && !i) {
             // indirect addressing
-            if (addr < 0 || addr >= (int)sizeof(mem)) {
-                printf("Error: Address out of range\n");
+            if (addr < 0 || addr >= (int)sizeof(m->mem)) {
+                report(m, "Error: Address out of range\n");
                 return -1;
             }
-            addr = (mem[addr] << 16) | (mem[addr + 1] << 8) | mem[addr + 2];
-            if (addr < 0 || addr >= (int)sizeof(mem)) {
-                printf("Error: Address out of range\n");
+            addr = (m->mem[addr] << 16) | (m->mem[addr + 1] << 8) | m->mem[addr + 2];
+            if (addr < 0 || addr >= (int)sizeof(m->mem)) {
+                report(m, "Error: Address out of range\n");
                 return -1;
             }
-            val = (mem[addr] << 16) | (mem[addr + 1] << 8) | mem[addr + 2];
+            val = (m->mem[addr] << 16) | (m->mem[addr + 1] << 8) | m->mem[addr + 2];
         } else {
             // immediate addressing
             val = addr;
@@ -698,10 +1161,22 @@ static int run_format_3_4()
     printf("addr = %06X, val = %06X\n", addr, val);
 #endif
 
-    switch (opcode) {
+    *target = addr;
+    *value = val;
+    return 0;
+}
+
+static int run_format_3_4(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+
+    switch (d->opcode) {
     // ADD
     case 0x18:
-        reg.A = reg.A + val;
+        m->reg.A = m->reg.A + val;
         break;
 
     // ADDF
@@ -710,12 +1185,12 @@ static int run_format_3_4()
 
     // AND
     case 0x40:
-        reg.A = reg.A & val;
+        m->reg.A = m->reg.A & val;
         break;
 
     // COMP
     case 0x28:
-        reg.SW = compare(reg.A, val);
+        m->reg.SW = compare(m->reg.A, val);
         break;
 
     // COMPF
@@ -724,7 +1199,7 @@ static int run_format_3_4()
 
     // DIV
     case 0x24:
-        reg.A = reg.A / val;
+        m->reg.A = m->reg.A / val;
         break;
 
     // DIVF
@@ -733,50 +1208,50 @@ static int run_format_3_4()
 
     // J
     case 0x3c:
-        reg.PC = addr;
+        m->reg.PC = addr;
         break;
 
     // JEQ
     case 0x30:
-        if (reg.SW == 0) {
-            reg.PC = addr;
+        if (m->reg.SW == 0) {
+            m->reg.PC = addr;
         }
         break;
 
     // JGT
     case 0x34:
-        if (reg.SW > 0) {
-            reg.PC = addr;
+        if (m->reg.SW > 0) {
+            m->reg.PC = addr;
         }
         break;
 
     // JLT
     case 0x38:
-        if (reg.SW < 0) {
-            reg.PC = addr;
+        if (m->reg.SW < 0) {
+            m->reg.PC = addr;
         }
         break;
 
     // JSUB
     case 0x48:
-        reg.L = reg.PC;
-        reg.PC = addr;
+        m->reg.L = m->reg.PC;
+        m->reg.PC = addr;
         break;
 
     // LDA
     case 0x00:
-        reg.A = val;
+        m->reg.A = val;
         break;
 
     // LDB
     case 0x68:
-        reg.B = val;
+        m->reg.B = val;
         break;
 
     // LDCH
     case 0x50:
-        reg.A &= ~0xff;
-        reg.A |= (val >> 16) & 0xff;
+        m->reg.A &= ~0xff;
+        m->reg.A |= (val >> 16) & 0xff;
         break;
 
     // LDF
@@ -785,22 +1260,22 @@ static int run_format_3_4()
 
     // LDL
     case 0x08:
-        reg.L = val;
+        m->reg.L = val;
         break;
 
     // LDS
     case 0x6c:
-        reg.S = val;
+        m->reg.S = val;
         break;
 
     // LDT
     case 0x74:
-        reg.T = val;
+        m->reg.T = val;
         break;
 
     // LDX
     case 0x04:
-        reg.X = val;
+        m->reg.X = val;
         break;
 
     // LPS
@@ -809,7 +1284,7 @@ static int run_format_3_4()
 
     // MUL
     case 0x20:
-        reg.A = reg.A * val;
+        m->reg.A = m->reg.A * val;
         break;
 
     // MULF
@@ -818,25 +1293,18 @@ static int run_format_3_4()
 
     // OR
     case 0x44:
-        reg.A = reg.A | val;
+        m->reg.A = m->reg.A | val;
         break;
 
     // RD
     case 0xd8:
-        // TODO: read data from _somewhere_
-        if (read_count < 100) {
-            reg.A &= ~0xff;
-            reg.A |= 0xff;
-            read_count++;
-        } else {
-            reg.A &= ~0xff;
-            reg.A |= 0x00;
-        }
+        m->reg.A &= ~0xff;
+        m->reg.A |= read_device(m);
         break;
 
     // RSUB
     case 0x4c:
-        reg.PC = reg.L;
+        m->reg.PC = m->reg.L;
         break;
 
     // SSK
@@ -845,25 +1313,27 @@ static int run_format_3_4()
 
     // STA
     case 0x0c:
-        if (set_memory(addr, reg.A) == -1) {
+        if (set_memory(m, addr, m->reg.A) == -1) {
             return -1;
         }
         break;
 
     // STB
     case 0x78:
-        if (set_memory(addr, reg.B) == -1) {
+        if (set_memory(m, addr, m->reg.B) == -1) {
             return -1;
         }
         break;
 
     // STCH
     case 0x54:
-        if (addr < 0 || addr >= (int)sizeof(mem)) {
-            printf("Error: Address out of range\n");
+        if (addr < 0 || addr >= (int)sizeof(m->mem)) {
+            report(m, "Error: Address out of range\n");
             return -1;
         }
-        mem[addr] = reg.A & 0xff;
+        log_write(m, addr, 1);
+        m->mem[addr] = m->reg.A & 0xff;
+        mark_written(m, addr, 1);
         break;
 
     // STF
@@ -876,14 +1346,14 @@ static int run_format_3_4()
 
     // STL
     case 0x14:
-        if (set_memory(addr, reg.L) == -1) {
+        if (set_memory(m, addr, m->reg.L) == -1) {
             return -1;
         }
         break;
 
     // STS
     case 0x7c:
-        if (set_memory(addr, reg.S) == -1) {
+        if (set_memory(m, addr, m->reg.S) == -1) {
             return -1;
         }
         break;
@@ -894,21 +1364,21 @@ static int run_format_3_4()
 
     // STT
     case 0x84:
-        if (set_memory(addr, reg.T) == -1) {
+        if (set_memory(m, addr, m->reg.T) == -1) {
             return -1;
         }
         break;
 
     // STX
     case 0x10:
-        if (set_memory(addr, reg.X) == -1) {
+        if (set_memory(m, addr, m->reg.X) == -1) {
             return -1;
         }
         break;
 
     // SUB
     case 0x1c:
-        reg.A = reg.A - val;
+        m->reg.A = m->reg.A - val;
         break;
 
     // SUBF
@@ -917,141 +1387,1314 @@ static int run_format_3_4()
 
     // TD
     case 0xe0:
-        reg.SW = -1; // <
+        m->reg.SW = -1; // <
         break;
 
     // TIX
     case 0x2c:
-        reg.X++;
-        reg.SW = compare(reg.X, val);
+        m->reg.X++;
+        m->reg.SW = compare(m->reg.X, val);
         break;
 
     // WD
     case 0xdc:
         // TODO: write better
-        printf("Write: %02X\n", reg.A & 0xff);
+        report(m, "Write: %02X\n", m->reg.A & 0xff);
         break;
     }
     return 0;
 }
 
-static int run_instr()
+// threaded engine: every opcode has a handler of its own, so running an
+// instruction is a single indirect call through its decoded entry
+
+static int op_fail_1(struct machine* m, const struct decoded* d)
 {
-    int opcode = mem[reg.PC] & 0xfc;
+    (void)m;
+    (void)d;
+    return -1;
+}
 
-#ifndef NDEBUG
-    printf("%06X %02X\n", reg.PC, opcode);
-    print_registers();
-#endif
-    switch (opcode) {
+static int op_fail_2(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    format_2_operands(m, d, &p1, &p2);
+    return -1;
+}
 
-    // format 1
-    case 0xc4:
-    case 0xc0:
-    case 0xf4:
-    case 0xc8:
-    case 0xf0:
-    case 0xf8:
-        if (run_format_1() == -1) {
-            printf("Error: Error while running instruction %02X\n", opcode);
-            return -1;
-        }
-        break;
+static int op_addr(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
+        return -1;
+    }
+    *p2 = *p2 + *p1;
+    return 0;
+}
 
-    // format 2
-    case 0x90:
-    case 0xb4:
-    case 0xa0:
-    case 0x9c:
-    case 0x98:
-    case 0xac:
-    case 0xa4:
-    case 0xa8:
-    case 0x94:
-    case 0xb0:
-    case 0xb8:
-        if (run_format_2() == -1) {
-            printf("Error: Error while running instruction %02X\n", opcode);
-            return -1;
-        }
-        break;
+static int op_clear(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
+        return -1;
+    }
+    *p1 = 0;
+    return 0;
+}
 
-    // format 3
-    case 0x18:
-    case 0x58:
-    case 0x40:
-    case 0x28:
-    case 0x88:
-    case 0x24:
-    case 0x64:
-    case 0x3c:
-    case 0x30:
-    case 0x34:
-    case 0x38:
-    case 0x48:
-    case 0x00:
-    case 0x68:
-    case 0x50:
-    case 0x70:
-    case 0x08:
-    case 0x6c:
-    case 0x74:
-    case 0x04:
-    case 0xd0:
-    case 0x20:
-    case 0x60:
-    case 0x44:
-    case 0xd8:
-    case 0x4c:
-    case 0xec:
-    case 0x0c:
-    case 0x78:
-    case 0x54:
-    case 0x80:
-    case 0xd4:
-    case 0x14:
-    case 0x7c:
-    case 0xe8:
-    case 0x84:
-    case 0x10:
-    case 0x1c:
-    case 0x5c:
-    case 0xe0:
-    case 0x2c:
-    case 0xdc:
-        if (run_format_3_4() == -1) {
-            printf("Error: Error while running instruction %02X\n", opcode);
-            return -1;
-        }
-        break;
+static int op_compr(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
+        return -1;
+    }
+    m->reg.SW = compare(*p1, *p2);
+    return 0;
+}
 
-    default:
-        printf("Error: unsupported instruction %02X\n", opcode);
+static int op_divr(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
         return -1;
     }
+    *p2 = *p2 / *p1;
     return 0;
 }
 
-void run(const char* cmd)
+static int op_mulr(struct machine* m, const struct decoded* d)
 {
-    char ch;
-    if (sscanf(cmd, " %c", &ch) == 1) {
-        printf("Invalid command.\n");
-        return;
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
+        return -1;
     }
+    *p2 = *p2 * *p1;
+    return 0;
+}
 
-    read_count = 0;
+static int op_rmo(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
+        return -1;
+    }
+    *p2 = *p1;
+    return 0;
+}
 
-    for (;;) {
-        if (run_instr() == -1) {
-            return;
-        }
-        for (int i = 0; i < nbreakpoints; ++i) {
-            if (breakpoints[i] == (int)reg.PC) {
-                print_registers();
-                printf("Stop at checkpoint [%04X]\n", (int)reg.PC);
-                return;
-            }
-        }
+static int op_subr(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
+        return -1;
+    }
+    *p2 = *p2 - *p1;
+    return 0;
+}
+
+static int op_tixr(struct machine* m, const struct decoded* d)
+{
+    int *p1, *p2;
+    if (format_2_operands(m, d, &p1, &p2) == -1) {
+        return -1;
+    }
+    m->reg.X++;
+    m->reg.SW = compare(m->reg.X, *p1);
+    return 0;
+}
+
+static int op_fail_3_4(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    format_3_4_operand(m, d, &addr, &val);
+    return -1;
+}
+
+static int op_add(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A = m->reg.A + val;
+    return 0;
+}
+
+static int op_and(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A = m->reg.A & val;
+    return 0;
+}
+
+static int op_comp(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.SW = compare(m->reg.A, val);
+    return 0;
+}
+
+static int op_div(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A = m->reg.A / val;
+    return 0;
+}
+
+static int op_j(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.PC = addr;
+    return 0;
+}
+
+static int op_jeq(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    if (m->reg.SW == 0) {
+        m->reg.PC = addr;
+    }
+    return 0;
+}
+
+static int op_jgt(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
     }
+    if (m->reg.SW > 0) {
+        m->reg.PC = addr;
+    }
+    return 0;
+}
+
+static int op_jlt(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    if (m->reg.SW < 0) {
+        m->reg.PC = addr;
+    }
+    return 0;
+}
+
+static int op_jsub(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.L = m->reg.PC;
+    m->reg.PC = addr;
+    return 0;
+}
+
+static int op_lda(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A = val;
+    return 0;
+}
+
+static int op_ldb(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.B = val;
+    return 0;
+}
+
+static int op_ldch(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A &= ~0xff;
+    m->reg.A |= (val >> 16) & 0xff;
+    return 0;
+}
+
+static int op_ldl(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.L = val;
+    return 0;
+}
+
+static int op_lds(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.S = val;
+    return 0;
+}
+
+static int op_ldt(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.T = val;
+    return 0;
+}
+
+static int op_ldx(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.X = val;
+    return 0;
+}
+
+static int op_mul(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A = m->reg.A * val;
+    return 0;
+}
+
+static int op_or(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A = m->reg.A | val;
+    return 0;
+}
+
+static int op_rd(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A &= ~0xff;
+    m->reg.A |= read_device(m);
+    return 0;
+}
+
+static int op_rsub(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.PC = m->reg.L;
+    return 0;
+}
+
+static int op_sub(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.A = m->reg.A - val;
+    return 0;
+}
+
+static int op_td(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.SW = -1;
+    return 0;
+}
+
+static int op_tix(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    m->reg.X++;
+    m->reg.SW = compare(m->reg.X, val);
+    return 0;
+}
+
+static int op_wd(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    report(m, "Write: %02X\n", m->reg.A & 0xff);
+    return 0;
+}
+
+static int op_sta(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    return set_memory(m, addr, m->reg.A);
+}
+
+static int op_stb(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    return set_memory(m, addr, m->reg.B);
+}
+
+static int op_stl(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    return set_memory(m, addr, m->reg.L);
+}
+
+static int op_sts(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    return set_memory(m, addr, m->reg.S);
+}
+
+static int op_stt(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    return set_memory(m, addr, m->reg.T);
+}
+
+static int op_stx(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    return set_memory(m, addr, m->reg.X);
+}
+
+static int op_stch(struct machine* m, const struct decoded* d)
+{
+    int addr, val;
+    if (format_3_4_operand(m, d, &addr, &val) == -1) {
+        return -1;
+    }
+    if (addr < 0 || addr >= (int)sizeof(m->mem)) {
+        report(m, "Error: Address out of range\n");
+        return -1;
+    }
+    log_write(m, addr, 1);
+    m->mem[addr] = m->reg.A & 0xff;
+    mark_written(m, addr, 1);
+    return 0;
+}
+
+// indexed by opcode >> 2
+static const handler threaded_ops[64] = {
+    [0x00 >> 2] = op_lda,
+    [0x04 >> 2] = op_ldx,
+    [0x08 >> 2] = op_ldl,
+    [0x0c >> 2] = op_sta,
+    [0x10 >> 2] = op_stx,
+    [0x14 >> 2] = op_stl,
+    [0x18 >> 2] = op_add,
+    [0x1c >> 2] = op_sub,
+    [0x20 >> 2] = op_mul,
+    [0x24 >> 2] = op_div,
+    [0x28 >> 2] = op_comp,
+    [0x2c >> 2] = op_tix,
+    [0x30 >> 2] = op_jeq,
+    [0x34 >> 2] = op_jgt,
+    [0x38 >> 2] = op_jlt,
+    [0x3c >> 2] = op_j,
+    [0x40 >> 2] = op_and,
+    [0x44 >> 2] = op_or,
+    [0x48 >> 2] = op_jsub,
+    [0x4c >> 2] = op_rsub,
+    [0x50 >> 2] = op_ldch,
+    [0x54 >> 2] = op_stch,
+    [0x58 >> 2] = op_fail_3_4,
+    [0x5c >> 2] = op_fail_3_4,
+    [0x60 >> 2] = op_fail_3_4,
+    [0x64 >> 2] = op_fail_3_4,
+    [0x68 >> 2] = op_ldb,
+    [0x6c >> 2] = op_lds,
+    [0x70 >> 2] = op_fail_3_4,
+    [0x74 >> 2] = op_ldt,
+    [0x78 >> 2] = op_stb,
+    [0x7c >> 2] = op_sts,
+    [0x80 >> 2] = op_fail_3_4,
+    [0x84 >> 2] = op_stt,
+    [0x88 >> 2] = op_fail_3_4,
+    [0x90 >> 2] = op_addr,
+    [0x94 >> 2] = op_subr,
+    [0x98 >> 2] = op_mulr,
+    [0x9c >> 2] = op_divr,
+    [0xa0 >> 2] = op_compr,
+    [0xa4 >> 2] = op_fail_2,
+    [0xa8 >> 2] = op_fail_2,
+    [0xac >> 2] = op_rmo,
+    [0xb0 >> 2] = op_fail_2,
+    [0xb4 >> 2] = op_clear,
+    [0xb8 >> 2] = op_tixr,
+    [0xc0 >> 2] = op_fail_1,
+    [0xc4 >> 2] = op_fail_1,
+    [0xc8 >> 2] = op_fail_1,
+    [0xd0 >> 2] = op_fail_3_4,
+    [0xd4 >> 2] = op_fail_3_4,
+    [0xd8 >> 2] = op_rd,
+    [0xdc >> 2] = op_wd,
+    [0xe0 >> 2] = op_td,
+    [0xe8 >> 2] = op_fail_3_4,
+    [0xec >> 2] = op_fail_3_4,
+    [0xf0 >> 2] = op_fail_1,
+    [0xf4 >> 2] = op_fail_1,
+    [0xf8 >> 2] = op_fail_1,
+};
+
+// decoded instruction at addr, from the cache if its bytes are unchanged
+static const struct decoded* decode(struct machine* m, int addr)
+{
+    struct decoded* d = &m->decode_cache[addr];
+    if (d->gen == m->decode_gen) {
+        return d;
+    }
+
+    d->gen = m->decode_gen;
+    d->opcode = m->mem[addr] & 0xfc;
+    d->op = threaded_ops[d->opcode >> 2];
+    switch (d->opcode) {
+
+    // format 1
+    case 0xc4:
+    case 0xc0:
+    case 0xf4:
+    case 0xc8:
+    case 0xf0:
+    case 0xf8:
+        d->run = run_format_1;
+        break;
+
+    // format 2
+    case 0x90:
+    case 0xb4:
+    case 0xa0:
+    case 0x9c:
+    case 0x98:
+    case 0xac:
+    case 0xa4:
+    case 0xa8:
+    case 0x94:
+    case 0xb0:
+    case 0xb8:
+        d->run = run_format_2;
+        d->r1 = (m->mem[addr + 1] >> 4) & 0x0f;
+        d->r2 = m->mem[addr + 1] & 0x0f;
+        break;
+
+    // format 3
+    case 0x18:
+    case 0x58:
+    case 0x40:
+    case 0x28:
+    case 0x88:
+    case 0x24:
+    case 0x64:
+    case 0x3c:
+    case 0x30:
+    case 0x34:
+    case 0x38:
+    case 0x48:
+    case 0x00:
+    case 0x68:
+    case 0x50:
+    case 0x70:
+    case 0x08:
+    case 0x6c:
+    case 0x74:
+    case 0x04:
+    case 0xd0:
+    case 0x20:
+    case 0x60:
+    case 0x44:
+    case 0xd8:
+    case 0x4c:
+    case 0xec:
+    case 0x0c:
+    case 0x78:
+    case 0x54:
+    case 0x80:
+    case 0xd4:
+    case 0x14:
+    case 0x7c:
+    case 0xe8:
+    case 0x84:
+    case 0x10:
+    case 0x1c:
+    case 0x5c:
+    case 0xe0:
+    case 0x2c:
+    case 0xdc:
+        d->run = run_format_3_4;
+        d->nixbpe = (m->mem[addr] & 0x03) << 4 | m->mem[addr + 1] >> 4;
+        if (!(d->nixbpe & 0x30)) {
+            // SIC compat instructions are rejected when run
+            d->disp = 0;
+        } else if (!(d->nixbpe & 0x01)) {
+            d->disp = (m->mem[addr + 1] & 0x0f) << 8 | m->mem[addr + 2];
+            if (d->disp & 0x800) {
+                d->disp |= 0xfffff000;
+            }
+        } else {
+            d->disp = (m->mem[addr + 1] & 0x0f) << 16 | m->mem[addr + 2] << 8 | m->mem[addr + 3];
+            if (d->disp & 0x80000) {
+                d->disp |= 0xfff00000;
+            }
+        }
+        break;
+
+    default:
+        d->run = NULL;
+        break;
+    }
+    return d;
+}
+
+static int run_instr(struct machine* m)
+{
+    if (m->reg.PC < 0 || m->reg.PC >= (int)sizeof(m->mem)) {
+        report(m, "Error: Address out of range\n");
+        return -1;
+    }
+
+    const struct decoded* d = decode(m, m->reg.PC);
+
+#ifndef NDEBUG
+    printf("%06X %02X\n", m->reg.PC, d->opcode);
+    print_registers(m);
+#endif
+    if (!d->run) {
+        report(m, "Error: unsupported instruction %02X\n", d->opcode);
+        return -1;
+    }
+
+    if (d->run(m, d) == -1) {
+        report(m, "Error: Error while running instruction %02X\n", d->opcode);
+        return -1;
+    }
+    return 0;
+}
+
+static int run_threaded_instr(struct machine* m)
+{
+    if (m->reg.PC < 0 || m->reg.PC >= (int)sizeof(m->mem)) {
+        report(m, "Error: Address out of range\n");
+        return -1;
+    }
+
+    const struct decoded* d = decode(m, m->reg.PC);
+    if (!d->op) {
+        report(m, "Error: unsupported instruction %02X\n", d->opcode);
+        return -1;
+    }
+
+    if (d->op(m, d) == -1) {
+        report(m, "Error: Error while running instruction %02X\n", d->opcode);
+        return -1;
+    }
+    return 0;
+}
+
+// state left by an engine, to be compared with that of the interpreter
+struct outcome {
+    int result;
+    int read_count;
+    struct registers reg;
+    int nwrites;
+    struct write writes[JIT_MAX_BLOCK];
+    unsigned char written[JIT_MAX_BLOCK][3];
+};
+
+static void save_outcome(struct machine* m, struct outcome* o, int result)
+{
+    o->result = result;
+    o->read_count = m->read_count;
+    o->reg = m->reg;
+    o->nwrites = m->nwrites;
+    for (int i = 0; i < m->nwrites; ++i) {
+        o->writes[i] = m->writes[i];
+        memcpy(o->written[i], m->mem + m->writes[i].addr, m->writes[i].len);
+    }
+}
+
+static void undo_writes(struct machine* m)
+{
+    for (int i = m->nwrites - 1; i >= 0; --i) {
+        memcpy(m->mem + m->writes[i].addr, m->writes[i].old, m->writes[i].len);
+        mark_written(m, m->writes[i].addr, m->writes[i].len);
+    }
+    m->nwrites = 0;
+}
+
+static int same_outcome(struct machine* m, const struct outcome* o, int result)
+{
+    if (o->result != result || o->read_count != m->read_count || o->nwrites != m->nwrites
+        || memcmp(&o->reg, &m->reg, sizeof(m->reg)) != 0) {
+        return 0;
+    }
+    for (int i = 0; i < m->nwrites; ++i) {
+        if (o->writes[i].addr != m->writes[i].addr || o->writes[i].len != m->writes[i].len
+            || memcmp(o->written[i], m->mem + m->writes[i].addr, m->writes[i].len) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void print_mismatch(const char* what, const char* engine, int expected, int actual)
+{
+    printf("\t%-8s interpreter %06X %s %06X\n", what, expected & 0xffffff, engine, actual & 0xffffff);
+}
+
+// compares the state of the interpreter with o, left by engine
+static void print_disagreement(struct machine* m, const char* engine, int pc, const struct outcome* o, int result)
+{
+    printf("Error: engines disagree at %06X\n", pc);
+    if (o->result != result) {
+        print_mismatch("result", engine, result, o->result);
+    }
+    print_mismatch("A", engine, m->reg.A, o->reg.A);
+    print_mismatch("X", engine, m->reg.X, o->reg.X);
+    print_mismatch("L", engine, m->reg.L, o->reg.L);
+    print_mismatch("PC", engine, m->reg.PC, o->reg.PC);
+    print_mismatch("B", engine, m->reg.B, o->reg.B);
+    print_mismatch("S", engine, m->reg.S, o->reg.S);
+    print_mismatch("T", engine, m->reg.T, o->reg.T);
+    print_mismatch("SW", engine, m->reg.SW, o->reg.SW);
+    for (int i = 0; i < o->nwrites || i < m->nwrites; ++i) {
+        print_mismatch("store at", engine, i < m->nwrites ? m->writes[i].addr : -1, i < o->nwrites ? o->writes[i].addr : -1);
+    }
+}
+
+// runs an instruction with the threaded engine, then undoes it and runs it
+// again with the interpreter, which must end up in the same state
+static int run_checked_instr(struct machine* m)
+{
+    int pc = m->reg.PC;
+    struct registers before = m->reg;
+    int count = m->read_count;
+    struct outcome threaded;
+
+    m->log_writes = 1;
+    m->nwrites = 0;
+    save_outcome(m, &threaded, run_threaded_instr(m));
+
+    undo_writes(m);
+    m->reg = before;
+    m->read_count = count;
+
+    m->quiet = 1;
+    int result = run_instr(m);
+    m->quiet = 0;
+    m->log_writes = 0;
+
+    if (same_outcome(m, &threaded, result)) {
+        return result;
+    }
+    print_disagreement(m, "threaded", pc, &threaded, result);
+    return -1;
+}
+
+// runs a translated block, then undoes it and runs as many instructions
+// with the interpreter, which must end up in the same state
+static int run_checked_block(struct machine* m, jit_block block)
+{
+    int pc = m->reg.PC;
+    struct registers before = m->reg;
+    struct outcome translated;
+
+    m->log_writes = 1;
+    m->nwrites = 0;
+    int status = block(m->mem, &m->reg);
+    save_outcome(m, &translated, 0);
+
+    undo_writes(m);
+    m->reg = before;
+
+    m->quiet = 1;
+    int result = 0;
+    for (int i = 0; i < status >> 8 && result == 0; ++i) {
+        result = run_instr(m);
+    }
+    m->quiet = 0;
+    m->log_writes = 0;
+
+    if (same_outcome(m, &translated, result)) {
+        return status;
+    }
+    print_disagreement(m, "jit", pc, &translated, result);
+    return -1;
+}
+
+// translated code only runs on the console machine
+static int jit_is_breakpoint(int addr)
+{
+    return is_breakpoint(console, addr);
+}
+
+static void jit_store_word(int addr, int val)
+{
+    set_memory(console, addr, val);
+}
+
+static void jit_store_byte(int addr, int val)
+{
+    log_write(console, addr, 1);
+    console->mem[addr] = (unsigned char)val;
+    mark_written(console, addr, 1);
+}
+
+// target address of the format 3/4 instruction at reg.PC without running
+// it, TRACE_NONE for other formats or addresses out of range
+static uint32_t target_address(struct machine* m, const struct decoded* d)
+{
+    if (d->run != run_format_3_4 || !(d->nixbpe & 0x30)) {
+        return TRACE_NONE;
+    }
+
+    int addr = d->disp;
+    if (d->nixbpe & 0x08) {
+        addr += m->reg.X & 0x800000 ? (int)(m->reg.X | 0xff000000) : m->reg.X;
+    }
+    if (d->nixbpe & 0x02) {
+        addr += m->reg.PC + (d->nixbpe & 0x01 ? 4 : 3);
+    }
+    if (d->nixbpe & 0x04) {
+        addr += m->reg.B;
+    }
+    // indirect
+    if ((d->nixbpe & 0x30) == 0x20) {
+        if (addr < 0 || addr + 2 >= (int)sizeof(m->mem)) {
+            return TRACE_NONE;
+        }
+        addr = (m->mem[addr] << 16) | (m->mem[addr + 1] << 8) | m->mem[addr + 2];
+    }
+    return (uint32_t)addr;
+}
+
+// engine that run steps with while tracing
+static int (*traced_step)(struct machine*);
+
+static int run_traced_instr(struct machine* m)
+{
+    if (m->reg.PC < 0 || m->reg.PC >= (int)sizeof(m->mem)) {
+        return traced_step(m);
+    }
+
+    const struct decoded* d = decode(m, m->reg.PC);
+    struct trace_record record = { (uint32_t)m->reg.PC, target_address(m, d), 0, d->opcode, 0xff, 0 };
+    struct registers before = m->reg;
+    if (traced_step(m) == -1) {
+        return -1;
+    }
+
+    // first changed register in format 2 numbering, PC aside
+    const int* old[] = { &before.A, &before.X, &before.L, &before.B, &before.S, &before.T, &before.SW };
+    const int* now[] = { &m->reg.A, &m->reg.X, &m->reg.L, &m->reg.B, &m->reg.S, &m->reg.T, &m->reg.SW };
+    const uint8_t number[] = { 0, 1, 2, 3, 4, 5, 9 };
+    for (int i = 0; i < 7; ++i) {
+        if (*old[i] != *now[i]) {
+            record.reg = number[i];
+            record.value = (uint32_t)*now[i];
+            break;
+        }
+    }
+    trace_add(&record);
+    return 0;
+}
+
+// register an undo entry restores for bit i of its mask
+static int* undo_register(struct machine* m, int i)
+{
+    int* registers[] = { &m->reg.A, &m->reg.X, &m->reg.L, &m->reg.B, &m->reg.S, &m->reg.T, &m->reg.SW };
+    return registers[i];
+}
+
+// engine that run --record steps with
+static int (*recorded_step)(struct machine*);
+
+// logs what the next instruction changes: an undo entry is the mask of
+// changed registers, the old PC in 3 bytes, 4 bytes for each register in
+// the mask, and then the address, length and old bytes of its store
+static int run_recorded_instr(struct machine* m)
+{
+    if (m->reg.PC < 0 || m->reg.PC >= (int)sizeof(m->mem)) {
+        return recorded_step(m);
+    }
+
+    int pc = m->reg.PC, old[7];
+    for (int i = 0; i < 7; ++i) {
+        old[i] = *undo_register(m, i);
+    }
+    m->log_writes = 1;
+    m->nwrites = 0;
+    // a failed instruction may have changed registers too, so it is logged
+    int result = recorded_step(m);
+    m->log_writes = 0;
+
+    unsigned char entry[UNDO_MAX_ENTRY];
+    int len = 4;
+    entry[0] = 0;
+    entry[1] = (pc >> 16) & 0xff;
+    entry[2] = (pc >> 8) & 0xff;
+    entry[3] = pc & 0xff;
+    for (int i = 0; i < 7; ++i) {
+        if (*undo_register(m, i) != old[i]) {
+            entry[0] |= 1 << i;
+            entry[len++] = (old[i] >> 24) & 0xff;
+            entry[len++] = (old[i] >> 16) & 0xff;
+            entry[len++] = (old[i] >> 8) & 0xff;
+            entry[len++] = old[i] & 0xff;
+        }
+    }
+    // an instruction stores at most once
+    if (m->nwrites) {
+        entry[len++] = (m->writes[0].addr >> 16) & 0xff;
+        entry[len++] = (m->writes[0].addr >> 8) & 0xff;
+        entry[len++] = m->writes[0].addr & 0xff;
+        entry[len++] = (unsigned char)m->writes[0].len;
+        memcpy(entry + len, m->writes[0].old, m->writes[0].len);
+        len += m->writes[0].len;
+    }
+    undo_push(entry, len);
+    return result;
+}
+
+static void undo_instr(struct machine* m, const unsigned char* entry, int len)
+{
+    m->reg.PC = entry[1] << 16 | entry[2] << 8 | entry[3];
+    int p = 4;
+    for (int i = 0; i < 7; ++i) {
+        if (entry[0] & 1 << i) {
+            *undo_register(m, i) = (int)((unsigned)entry[p] << 24 | entry[p + 1] << 16 | entry[p + 2] << 8 | entry[p + 3]);
+            p += 4;
+        }
+    }
+    if (p < len) {
+        int addr = entry[p] << 16 | entry[p + 1] << 8 | entry[p + 2];
+        memcpy(m->mem + addr, entry + p + 4, entry[p + 3]);
+        mark_written(m, addr, entry[p + 3]);
+    }
+}
+
+void rstep(const char* cmd)
+{
+    struct machine* m = console_machine();
+    char ch;
+    int n = 1;
+    int cnt = sscanf(cmd, "%d %c", &n, &ch);
+    if ((cnt != EOF && cnt != 1) || n <= 0) {
+        printf("Invalid command.\n");
+        return;
+    }
+
+    unsigned char entry[UNDO_MAX_ENTRY];
+    int i, len = 0;
+    for (i = 0; i < n && (len = undo_pop(entry)) != 0; ++i) {
+        undo_instr(m, entry, len);
+    }
+
+    print_registers(m);
+    if (i < n) {
+        printf("Stop at start of undo log [%04X]\n", (int)m->reg.PC);
+    } else {
+        printf("Step back to [%04X]\n", (int)m->reg.PC);
+    }
+}
+
+void rcontinue(const char* cmd)
+{
+    struct machine* m = console_machine();
+    char ch;
+    if (sscanf(cmd, " %c", &ch) == 1) {
+        printf("Invalid command.\n");
+        return;
+    }
+
+    unsigned char entry[UNDO_MAX_ENTRY];
+    int len;
+    while ((len = undo_pop(entry)) != 0) {
+        undo_instr(m, entry, len);
+        if (m->nbreakpoints && is_breakpoint(m, m->reg.PC)) {
+            print_registers(m);
+            printf("Stop at checkpoint [%04X]\n", (int)m->reg.PC);
+            return;
+        }
+    }
+
+    print_registers(m);
+    printf("Stop at start of undo log [%04X]\n", (int)m->reg.PC);
+}
+
+// engine that run --profile steps with
+static int (*profiled_step)(struct machine*);
+
+static int run_profiled_instr(struct machine* m)
+{
+    int pc = m->reg.PC;
+    if (pc < 0 || pc >= (int)sizeof(m->mem)) {
+        return profiled_step(m);
+    }
+
+    const struct decoded* d = decode(m, pc);
+    int opcode = d->opcode;
+    int format = d->run == run_format_1 ? 1 : d->run == run_format_2 ? 2 : d->nixbpe & 1 ? 4 : 3;
+    // conditional jumps test SW before they run
+    int sw = m->reg.SW;
+    if (profiled_step(m) == -1) {
+        return -1;
+    }
+
+    profile_count(pc, opcode, format);
+    if (opcode == 0x30) {
+        profile_branch(pc, sw == 0);
+    } else if (opcode == 0x34) {
+        profile_branch(pc, sw > 0);
+    } else if (opcode == 0x38) {
+        profile_branch(pc, sw < 0);
+    }
+    return 0;
+}
+
+void run(const char* cmd)
+{
+    struct machine* m = console_machine();
+    char ch, args[3][10];
+    const char* mode = NULL;
+    int (*step)(struct machine*) = run_instr;
+    int jit = 0, check = 0, profile = 0, record = 0;
+    int cnt = sscanf(cmd, "%9s %9s %9s %c", args[0], args[1], args[2], &ch);
+    for (int i = 0; i < cnt; ++i) {
+        if (i < 3 && !profile && strcmp(args[i], "--profile") == 0) {
+            profile = 1;
+        } else if (i < 3 && !record && strcmp(args[i], "--record") == 0) {
+            record = 1;
+        } else if (i < 3 && !mode) {
+            mode = args[i];
+        } else {
+            printf("Invalid command.\n");
+            return;
+        }
+    }
+    if (!mode) {
+        // plain interpreter
+    } else if (strcmp(mode, "threaded") == 0) {
+        step = run_threaded_instr;
+    } else if (strcmp(mode, "check") == 0) {
+        step = run_checked_instr;
+    } else if (strcmp(mode, "jit") == 0 || strcmp(mode, "jitcheck") == 0) {
+        jit = 1;
+        check = strcmp(mode, "jitcheck") == 0;
+    } else {
+        printf("Invalid command.\n");
+        return;
+    }
+
+    // the profiler and the trace see one instruction at a time
+    if (profile && (jit || step == run_checked_instr)) {
+        printf("Error: --profile works with the interpreter or threaded engine\n");
+        return;
+    }
+    if (trace_enabled() && (jit || step == run_checked_instr)) {
+        printf("Error: trace works with the interpreter or threaded engine\n");
+        return;
+    }
+    if (record && (jit || step == run_checked_instr)) {
+        printf("Error: --record works with the interpreter or threaded engine\n");
+        return;
+    }
+    if (record) {
+        recorded_step = step;
+        step = run_recorded_instr;
+    } else {
+        // the log would no longer lead back from the state this run leaves
+        undo_clear();
+    }
+    if (trace_enabled()) {
+        traced_step = step;
+        step = run_traced_instr;
+    }
+    if (profile) {
+        profiled_step = step;
+        step = run_profiled_instr;
+        profile_start();
+    }
+
+    if (jit) {
+        struct jit_env env = { m->mem, jit_is_breakpoint, jit_store_word, jit_store_byte };
+        if (jit_init(&env) == -1) {
+            printf("Error: JIT is not supported on this machine\n");
+            return;
+        }
+        m->jit = 1;
+    }
+
+    execute(m, step, jit, check, 0);
+
+    if (profile) {
+        profile_report(m->loaded, m->nloaded);
+    }
+}
+
+// runs m from PC until an instruction fails or a breakpoint is reached;
+// returns -1 if it was stopped after max_steps instructions (or blocks of
+// the JIT) instead, 0 for no limit
+static int execute(struct machine* m, int (*step)(struct machine*), int jit, int check, long long max_steps)
+{
+    m->read_count = 0;
+
+    // set when a block stops before an instruction it cannot run
+    int fallback = 0;
+    for (long long steps = 0;; ++steps) {
+        if (max_steps && steps == max_steps) {
+            fprintf(m->out, "Error: stopped after %lld steps\n", max_steps);
+            return -1;
+        }
+        jit_block block = NULL;
+        if (jit && !fallback && m->reg.PC >= 0 && m->reg.PC < (int)sizeof(m->mem)) {
+            block = jit_lookup(m->reg.PC);
+        }
+        fallback = 0;
+        if (block) {
+            int status = check ? run_checked_block(m, block) : block(m->mem, &m->reg);
+            if (status == -1) {
+                break;
+            }
+            fallback = status & JIT_FALLBACK;
+            if (status >> 8 == 0) {
+                continue;
+            }
+        } else if (step(m) == -1) {
+            break;
+        }
+        if (m->nbreakpoints && is_breakpoint(m, m->reg.PC)) {
+            print_registers(m);
+            fprintf(m->out, "Stop at checkpoint [%04X]\n", (int)m->reg.PC);
+            break;
+        }
+    }
+    return 0;
+}
+
+// steps a batch job may run unless its line gives --steps, so that a
+// program that never ends fails its job instead of hanging the batch
+#define BATCH_STEPS 100000000LL
+
+struct run_job {
+    // as written, "@list" expanded when the job runs
+    char (*files)[100];
+    int nfiles;
+    char input[100]; // empty if RD gets the default device
+    long long max_steps;
+    char* output;
+    size_t size;
+    int result;
+};
+
+// "file... [--steps n] [< input]"; returns -1 if there is no file
+static int parse_job(const char* line, struct run_job* job)
+{
+    char word[100];
+    int n;
+
+    job->files = NULL;
+    job->nfiles = 0;
+    job->input[0] = 0;
+    job->max_steps = BATCH_STEPS;
+    while (sscanf(line, "%99s%n", word, &n) == 1) {
+        line += n;
+        if (job->input[0]) {
+            return -1;
+        } else if (strcmp(word, "<") == 0) {
+            if (sscanf(line, "%99s%n", job->input, &n) != 1) {
+                return -1;
+            }
+            line += n;
+        } else if (strcmp(word, "--steps") == 0) {
+            char ch;
+            if (sscanf(line, "%99s%n", word, &n) != 1 || sscanf(word, "%lld %c", &job->max_steps, &ch) != 1
+                || job->max_steps <= 0) {
+                return -1;
+            }
+            line += n;
+        } else {
+            job->files = realloc(job->files, sizeof(*job->files) * (job->nfiles + 1));
+            strcpy(job->files[job->nfiles++], word);
+        }
+    }
+    return job->nfiles ? 0 : -1;
+}
+
+static unsigned char* read_input(const char* file, int* len)
+{
+    FILE* fp = fopen(file, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    unsigned char* data = NULL;
+    int size = 0, cap = 0, n;
+    do {
+        if (size == cap) {
+            cap = cap ? cap * 2 : 4096;
+            data = realloc(data, cap);
+        }
+        n = (int)fread(data + size, 1, cap - size, fp);
+        size += n;
+    } while (n > 0);
+    fclose(fp);
+    *len = size;
+    return data;
+}
+
+static void run_job(void* arg, int i)
+{
+    struct run_job* job = (struct run_job*)arg + i;
+
+    // messages are collected and printed once all jobs are done
+    FILE* out = open_memstream(&job->output, &job->size);
+    struct machine* m = new_machine(out ? out : stdout);
+    unsigned char* input = NULL;
+    char (*files)[100] = NULL;
+    int nfiles = 0;
+    job->result = -1;
+
+    for (int j = 0; j < job->nfiles; ++j) {
+        if (add_files(m->out, job->files[j], &files, &nfiles) == -1) {
+            goto done;
+        }
+    }
+
+    if (nfiles == 0) {
+        fprintf(m->out, "Error: no object files\n");
+    } else if (job->input[0] && !(input = read_input(job->input, &m->input_len))) {
+        fprintf(m->out, "Error: error opening file %s\n", job->input);
+    } else if (load(m, nfiles, files, 1) == 0) {
+        m->input = input;
+        int stopped = execute(m, run_threaded_instr, 0, 0, job->max_steps);
+        print_registers(m);
+        job->result = stopped;
+    }
+
+done:
+    free(input);
+    free(files);
+    free_machine(m);
+    if (out) {
+        fclose(out);
+    }
+}
+
+int run_batch(const char* file)
+{
+    FILE* fp = fopen(file, "r");
+    if (!fp) {
+        printf("Error: error opening file %s\n", file);
+        return 1;
+    }
+
+    // one job per line, each on a machine of its own
+    struct run_job* jobs = NULL;
+    int* lines = NULL;
+    int njobs = 0, lineno = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        ++lineno;
+        char ch;
+        if (sscanf(line, " %c", &ch) != 1) {
+            continue;
+        }
+        jobs = realloc(jobs, sizeof(struct run_job) * (njobs + 1));
+        lines = realloc(lines, sizeof(int) * (njobs + 1));
+        if (parse_job(line, &jobs[njobs]) == -1) {
+            printf("%s:%d: Error: expected object files, an optional '--steps n' and '< input'\n", file, lineno);
+            fclose(fp);
+            for (int i = 0; i <= njobs; ++i) {
+                free(jobs[i].files);
+            }
+            free(jobs);
+            free(lines);
+            return 1;
+        }
+        jobs[njobs].output = NULL;
+        jobs[njobs].size = 0;
+        lines[njobs++] = lineno;
+    }
+    fclose(fp);
+
+    parallel_for(njobs, parallel_threads(), run_job, jobs);
+
+    int failed = 0;
+    for (int i = 0; i < njobs; ++i) {
+        // prefix every message with the job it belongs to
+        char* text = jobs[i].output;
+        while (text && *text) {
+            char* eol = strchr(text, '\n');
+            int len = eol ? (int)(eol - text) : (int)strlen(text);
+            printf("%s:%d: %.*s\n", file, lines[i], len, text);
+            text += eol ? len + 1 : len;
+        }
+        free(jobs[i].output);
+        free(jobs[i].files);
+
+        if (jobs[i].result == -1) {
+            failed++;
+        }
+    }
+
+    printf("%d of %d jobs loaded and run.\n", njobs - failed, njobs);
+
+    free(jobs);
+    free(lines);
+    return failed ? 1 : 0;
 }
@@ -9,7 +9,17 @@ void reset(const char* cmd);
 void progaddr(const char* cmd);
 void loader(const char* cmd);
 void run(const char* cmd);
+void rstep(const char* cmd);
+void rcontinue(const char* cmd);
 void breakpoint(const char* cmd);
-void free_breakpoints(void);
+
+void snapshot(const char* cmd);
+
+// frees the machine the commands above work on
+void free_console(void);
+
+// loads and runs the jobs listed in file, one per line, on machines of
+// their own; returns the exit status
+int run_batch(const char* file);
 
 #endif
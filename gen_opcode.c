@@ -0,0 +1,164 @@
+// Build-time generator for opcode_table.h.
+//
+// Reads opcode.txt and searches for a hash seed that places every mnemonic
+// in its own slot, so that a lookup is one hash and one compare.
+
+#include "opcode_hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_OPCODES 256
+#define MAX_SEEDS 1000000
+
+struct entry {
+    char mnemonic[10];
+    int opcode;
+    const char* format;
+};
+
+static struct entry entries[MAX_OPCODES];
+static int nentries = 0;
+
+static int read_opcodes(const char* file)
+{
+    FILE* fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open %s\n", file);
+        return -1;
+    }
+
+    int opcode;
+    char mnemonic[10], format[10];
+    while (fscanf(fp, "%x %9s %9s", &opcode, mnemonic, format) == 3) {
+        const char* fmt;
+        if (strcmp(format, "1") == 0) {
+            fmt = "FORMAT_1";
+        } else if (strcmp(format, "2") == 0) {
+            fmt = "FORMAT_2";
+        } else if (strcmp(format, "3/4") == 0) {
+            fmt = "FORMAT_3_4";
+        } else {
+            fprintf(stderr, "Invalid format: %s\n", format);
+            fclose(fp);
+            return -1;
+        }
+
+        int dup = 0;
+        for (int i = 0; i < nentries; ++i) {
+            if (strcmp(entries[i].mnemonic, mnemonic) == 0) {
+                dup = 1;
+                break;
+            }
+        }
+        if (dup) {
+            continue;
+        }
+
+        if (nentries == MAX_OPCODES) {
+            fprintf(stderr, "Error: too many opcodes\n");
+            fclose(fp);
+            return -1;
+        }
+
+        strcpy(entries[nentries].mnemonic, mnemonic);
+        entries[nentries].opcode = opcode;
+        entries[nentries].format = fmt;
+        nentries++;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// returns 0 if every mnemonic gets a distinct slot
+static int try_seed(unsigned seed, unsigned size, int* slots)
+{
+    for (unsigned i = 0; i < size; ++i) {
+        slots[i] = -1;
+    }
+
+    for (int i = 0; i < nentries; ++i) {
+        const char* m = entries[i].mnemonic;
+        unsigned h = opcode_hash(m, (int)strlen(m), seed, size);
+        if (slots[h] != -1) {
+            return -1;
+        }
+        slots[h] = i;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s opcode.txt\n", argv[0]);
+        return 1;
+    }
+
+    if (read_opcodes(argv[1]) == -1) {
+        return 1;
+    }
+
+    static int slots[MAX_OPCODES * 16];
+    unsigned size = 1;
+    while (size < (unsigned)nentries * 4) {
+        size *= 2;
+    }
+
+    unsigned seed = 0;
+    for (;;) {
+        while (seed < MAX_SEEDS && try_seed(seed, size, slots) == -1) {
+            seed++;
+        }
+        if (seed < MAX_SEEDS) {
+            break;
+        }
+        if (size == MAX_OPCODES * 16) {
+            fprintf(stderr, "Error: cannot find a perfect hash\n");
+            return 1;
+        }
+        size *= 2;
+        seed = 0;
+    }
+
+    // fingerprint of the table contents, so that cached assembler
+    // output can be invalidated when opcode.txt changes
+    unsigned long long fingerprint = 0xcbf29ce484222325ull;
+    for (int i = 0; i < nentries; ++i) {
+        char line[64];
+        snprintf(line, sizeof(line), "%s %02X %s\n", entries[i].mnemonic, entries[i].opcode, entries[i].format);
+        for (int j = 0; line[j]; ++j) {
+            fingerprint ^= (unsigned char)line[j];
+            fingerprint *= 0x100000001b3ull;
+        }
+    }
+
+    printf("// generated from %s by gen_opcode.c; do not edit\n\n", argv[1]);
+    printf("#define OPCODE_HASH_SEED %uu\n", seed);
+    printf("#define OPCODE_TABLE_SIZE %uu\n", size);
+    printf("#define OPCODE_TABLE_FINGERPRINT 0x%016llXull\n\n", fingerprint);
+
+    // perfect hash table
+    printf("static const struct opcode_info opcode_table[OPCODE_TABLE_SIZE] = {\n");
+    for (unsigned i = 0; i < size; ++i) {
+        if (slots[i] == -1) {
+            continue;
+        }
+        struct entry* e = &entries[slots[i]];
+        printf("    [%u] = { \"%s\", %d, 0x%02X, %s },\n",
+            i, e->mnemonic, (int)strlen(e->mnemonic), e->opcode, e->format);
+    }
+    printf("};\n\n");
+
+    // slot of every mnemonic in opcode.txt order, for opcodelist
+    printf("static const int opcode_order[] = {\n");
+    for (int i = 0; i < nentries; ++i) {
+        const char* m = entries[i].mnemonic;
+        printf("    %u,\n", opcode_hash(m, (int)strlen(m), seed, size));
+    }
+    printf("};\n");
+
+    return 0;
+}
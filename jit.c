@@ -0,0 +1,839 @@
+// Basic-block translator from SIC/XE to x86-64.
+//
+// A block is straight-line code up to the first jump. While it runs, the
+// guest A, X, T and S live in rbx, r12, r13 and r14, mem[] is addressed
+// through r15 and the rest of struct registers through rbp. Instructions
+// the translator does not handle, and operands that fail a range check,
+// end the block so that the interpreter runs them and reports the error.
+
+#include "jit.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+#define CODE_SIZE (16 * 1024 * 1024)
+#define BLOCK_ROOM (JIT_MAX_BLOCK * 256) // enough for the longest block
+#define PAGE_BITS 12
+
+static struct jit_env env;
+
+static unsigned char* code = NULL;
+static int code_len = 0;
+static int flushed = 0;
+
+// blocks by start address, one lazily allocated table per page
+static jit_block* blocks[MEMORY_SIZE >> PAGE_BITS];
+
+// bytes of translated instructions, within [covered_lo, covered_hi)
+static unsigned char covered[MEMORY_SIZE];
+static int covered_lo = MEMORY_SIZE, covered_hi = 0;
+
+enum host_reg {
+    EAX = 0,
+    ECX = 1,
+    EDX = 2,
+    EBX = 3,
+    EBP = 5,
+    ESI = 6,
+    EDI = 7,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15,
+};
+
+enum cond {
+    CC_B = 0x2,
+    CC_E = 0x4,
+    CC_L = 0xc,
+    CC_G = 0xf,
+};
+
+struct emitter {
+    unsigned char* p;
+    unsigned char* epilogue;
+};
+
+static void byte(struct emitter* e, int b)
+{
+    *e->p++ = (unsigned char)b;
+}
+
+static void imm32(struct emitter* e, int v)
+{
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static void rex(struct emitter* e, int w, int r, int b)
+{
+    int bits = (w ? 8 : 0) | (r >= 8 ? 4 : 0) | (b >= 8 ? 1 : 0);
+    if (bits) {
+        byte(e, 0x40 | bits);
+    }
+}
+
+static void modrm(struct emitter* e, int mod, int reg, int rm)
+{
+    byte(e, mod << 6 | (reg & 7) << 3 | (rm & 7));
+}
+
+// opc reg, rm or opc rm, reg between 32-bit registers
+static void op_rr(struct emitter* e, int opc, int reg, int rm)
+{
+    rex(e, 0, reg, rm);
+    byte(e, opc);
+    modrm(e, 3, reg, rm);
+}
+
+// group 1 operation ext with a 32-bit immediate: 0 add, 1 or, 4 and, 7 cmp
+static void op_ri(struct emitter* e, int ext, int rm, int imm)
+{
+    rex(e, 0, 0, rm);
+    byte(e, 0x81);
+    modrm(e, 3, ext, rm);
+    imm32(e, imm);
+}
+
+// opc reg, [rbp + offset] or opc [rbp + offset], reg
+static void op_rm(struct emitter* e, int opc, int reg, int offset)
+{
+    rex(e, 0, reg, EBP);
+    byte(e, opc);
+    modrm(e, 1, reg, EBP);
+    byte(e, offset);
+}
+
+static void mov_ri(struct emitter* e, int r, int imm)
+{
+    rex(e, 0, 0, r);
+    byte(e, 0xb8 + (r & 7));
+    imm32(e, imm);
+}
+
+static void mov_mi(struct emitter* e, int offset, int imm)
+{
+    byte(e, 0xc7);
+    modrm(e, 1, 0, EBP);
+    byte(e, offset);
+    imm32(e, imm);
+}
+
+static void mov_rr(struct emitter* e, int dst, int src)
+{
+    if (dst != src) {
+        op_rr(e, 0x89, src, dst);
+    }
+}
+
+// movzx dst, byte [r15 + rcx + offset]
+static void load_byte(struct emitter* e, int dst, int offset)
+{
+    rex(e, 0, dst, R15);
+    byte(e, 0x0f);
+    byte(e, 0xb6);
+    modrm(e, offset ? 1 : 0, dst, 4);
+    byte(e, 1 << 3 | (R15 & 7));
+    if (offset) {
+        byte(e, offset);
+    }
+}
+
+static void shl_ri(struct emitter* e, int r, int n)
+{
+    rex(e, 0, 0, r);
+    byte(e, 0xc1);
+    modrm(e, 3, 4, r);
+    byte(e, n);
+}
+
+static void shr_ri(struct emitter* e, int r, int n)
+{
+    rex(e, 0, 0, r);
+    byte(e, 0xc1);
+    modrm(e, 3, 5, r);
+    byte(e, n);
+}
+
+static void imul_rr(struct emitter* e, int dst, int src)
+{
+    rex(e, 0, dst, src);
+    byte(e, 0x0f);
+    byte(e, 0xaf);
+    modrm(e, 3, dst, src);
+}
+
+static void test_ri(struct emitter* e, int r, int imm)
+{
+    rex(e, 0, 0, r);
+    byte(e, 0xf7);
+    modrm(e, 3, 0, r);
+    imm32(e, imm);
+}
+
+static unsigned char* jcc8(struct emitter* e, int cc)
+{
+    byte(e, 0x70 + cc);
+    byte(e, 0);
+    return e->p - 1;
+}
+
+static void patch8(struct emitter* e, unsigned char* at)
+{
+    *at = (unsigned char)(e->p - (at + 1));
+}
+
+static void call(struct emitter* e, const void* fn)
+{
+    byte(e, 0x48);
+    byte(e, 0xb8);
+    memcpy(e->p, &fn, 8);
+    e->p += 8;
+    byte(e, 0xff);
+    byte(e, 0xd0);
+}
+
+static void push(struct emitter* e, int r)
+{
+    rex(e, 0, 0, r);
+    byte(e, 0x50 + (r & 7));
+}
+
+static void pop(struct emitter* e, int r)
+{
+    rex(e, 0, 0, r);
+    byte(e, 0x58 + (r & 7));
+}
+
+// host register of a guest register, or -1 if it stays in struct registers
+static int host_reg(int n)
+{
+    switch (n) {
+    case 0:
+        return EBX;
+    case 1:
+        return R12;
+    case 4:
+        return R14;
+    case 5:
+        return R13;
+    }
+    return -1;
+}
+
+static int reg_offset(int n)
+{
+    switch (n) {
+    case 2:
+        return offsetof(struct registers, L);
+    case 3:
+        return offsetof(struct registers, B);
+    case 8:
+        return offsetof(struct registers, PC);
+    case 9:
+        return offsetof(struct registers, SW);
+    }
+    return -1;
+}
+
+static void load_guest(struct emitter* e, int dst, int n)
+{
+    int h = host_reg(n);
+    if (h != -1) {
+        mov_rr(e, dst, h);
+    } else {
+        op_rm(e, 0x8b, dst, reg_offset(n));
+    }
+}
+
+static void store_guest(struct emitter* e, int n, int src)
+{
+    int h = host_reg(n);
+    if (h != -1) {
+        mov_rr(e, h, src);
+    } else {
+        op_rm(e, 0x89, src, reg_offset(n));
+    }
+}
+
+// if (r & 0x800000) r |= 0xff000000, as the interpreter does
+static void sign_extend(struct emitter* e, int r)
+{
+    test_ri(e, r, 0x800000);
+    unsigned char* skip = jcc8(e, CC_E);
+    op_ri(e, 1, r, (int)0xff000000);
+    patch8(e, skip);
+}
+
+static void sign_extend_guest(struct emitter* e, int n)
+{
+    int h = host_reg(n);
+    if (h != -1) {
+        sign_extend(e, h);
+    } else {
+        load_guest(e, EAX, n);
+        sign_extend(e, EAX);
+        store_guest(e, n, EAX);
+    }
+}
+
+// SW = compare(a, b); clobbers eax and edx
+static void compare(struct emitter* e, int a, int b)
+{
+    op_rr(e, 0x39, b, a);
+    byte(e, 0x0f); // setg al
+    byte(e, 0x90 + CC_G);
+    modrm(e, 3, 0, EAX);
+    byte(e, 0x0f); // setl dl
+    byte(e, 0x90 + CC_L);
+    modrm(e, 3, 0, EDX);
+    byte(e, 0x28); // sub al, dl
+    modrm(e, 3, EDX, EAX);
+    byte(e, 0x0f); // movsx eax, al
+    byte(e, 0xbe);
+    modrm(e, 3, EAX, EAX);
+    op_rm(e, 0x89, EAX, reg_offset(9));
+}
+
+// leaves the block with status in eax; PC must already be stored
+static void leave(struct emitter* e, int status)
+{
+    mov_ri(e, EAX, status);
+    byte(e, 0xe9);
+    imm32(e, (int)(e->epilogue - (e->p + 4)));
+}
+
+static void leave_at(struct emitter* e, int pc, int status)
+{
+    mov_mi(e, reg_offset(8), pc);
+    leave(e, status);
+}
+
+// leaves before the instruction at pc unless 0 <= ecx < MEMORY_SIZE
+static void check_address(struct emitter* e, int pc, int status)
+{
+    op_ri(e, 7, ECX, MEMORY_SIZE);
+    unsigned char* ok = jcc8(e, CC_B);
+    leave_at(e, pc, status);
+    patch8(e, ok);
+}
+
+// eax = the word at [r15 + rcx]; clobbers edx
+static void load_word(struct emitter* e)
+{
+    load_byte(e, EAX, 0);
+    shl_ri(e, EAX, 16);
+    load_byte(e, EDX, 1);
+    shl_ri(e, EDX, 8);
+    op_rr(e, 0x09, EDX, EAX);
+    load_byte(e, EDX, 2);
+    op_rr(e, 0x09, EDX, EAX);
+}
+
+static int store_word(int addr, int val)
+{
+    flushed = 0;
+    env.store(addr, val);
+    return flushed;
+}
+
+static int store_byte(int addr, int val)
+{
+    flushed = 0;
+    env.store_byte(addr, val);
+    return flushed;
+}
+
+// calls fn(ecx, src) and leaves the block if it changed translated code
+static void store(struct emitter* e, int (*fn)(int, int), int src, int next, int status)
+{
+    mov_rr(e, ESI, src);
+    mov_rr(e, EDI, ECX);
+    call(e, (const void*)fn);
+    test_ri(e, EAX, -1);
+    unsigned char* same = jcc8(e, CC_E);
+    leave_at(e, next, status);
+    patch8(e, same);
+}
+
+static int valid_format_2_reg(int n)
+{
+    return n >= 0 && n <= 5;
+}
+
+// translates the format 2 instruction at pc; returns its length or 0
+static int translate_format_2(struct emitter* e, int pc)
+{
+    const unsigned char* m = env.mem + pc;
+    int opcode = m[0] & 0xfc;
+    int r1 = m[1] >> 4, r2 = m[1] & 0x0f;
+    if (!valid_format_2_reg(r1) || !valid_format_2_reg(r2)) {
+        return 0;
+    }
+
+    switch (opcode) {
+    case 0x90: // ADDR
+    case 0xb4: // CLEAR
+    case 0xa0: // COMPR
+    case 0x98: // MULR
+    case 0xac: // RMO
+    case 0x94: // SUBR
+    case 0xb8: // TIXR
+        break;
+    default:
+        return 0;
+    }
+
+    sign_extend_guest(e, r1);
+    sign_extend_guest(e, r2);
+    load_guest(e, EAX, r1);
+    load_guest(e, ECX, r2);
+
+    switch (opcode) {
+    case 0x90: // ADDR
+        op_rr(e, 0x01, EAX, ECX);
+        store_guest(e, r2, ECX);
+        break;
+    case 0xb4: // CLEAR
+        mov_ri(e, EAX, 0);
+        store_guest(e, r1, EAX);
+        break;
+    case 0xa0: // COMPR
+        compare(e, EAX, ECX);
+        break;
+    case 0x98: // MULR
+        imul_rr(e, ECX, EAX);
+        store_guest(e, r2, ECX);
+        break;
+    case 0xac: // RMO
+        store_guest(e, r2, EAX);
+        break;
+    case 0x94: // SUBR
+        op_rr(e, 0x29, EAX, ECX);
+        store_guest(e, r2, ECX);
+        break;
+    case 0xb8: // TIXR
+        op_ri(e, 0, R12, 1);
+        load_guest(e, ECX, r1);
+        compare(e, R12, ECX);
+        break;
+    }
+    return 2;
+}
+
+// translates the format 3/4 instruction at pc, the n-th of its block;
+// returns its length or 0, and sets *ends if the block ends after it
+static int translate_format_3_4(struct emitter* e, int pc, int n, int* ends)
+{
+    const unsigned char* m = env.mem + pc;
+    int opcode = m[0] & 0xfc;
+    int ni = m[0] & 0x03;
+    int x = m[1] & 0x80, b = m[1] & 0x40, p = m[1] & 0x20, ext = m[1] & 0x10;
+    if (!ni) {
+        return 0;
+    }
+
+    int len = ext ? 4 : 3;
+    int disp;
+    if (ext) {
+        disp = (m[1] & 0x0f) << 16 | m[2] << 8 | m[3];
+        if (disp & 0x80000) {
+            disp |= 0xfff00000;
+        }
+    } else {
+        disp = (m[1] & 0x0f) << 8 | m[2];
+        if (disp & 0x800) {
+            disp |= 0xfffff000;
+        }
+    }
+    int next = pc + len;
+
+    int uses_value = 1;
+    switch (opcode) {
+    case 0x18: // ADD
+    case 0x40: // AND
+    case 0x28: // COMP
+    case 0x00: // LDA
+    case 0x68: // LDB
+    case 0x50: // LDCH
+    case 0x08: // LDL
+    case 0x6c: // LDS
+    case 0x74: // LDT
+    case 0x04: // LDX
+    case 0x20: // MUL
+    case 0x44: // OR
+    case 0x1c: // SUB
+    case 0xe0: // TD
+    case 0x2c: // TIX
+        break;
+    case 0x3c: // J
+    case 0x30: // JEQ
+    case 0x34: // JGT
+    case 0x38: // JLT
+    case 0x48: // JSUB
+    case 0x4c: // RSUB
+        *ends = 1;
+        uses_value = 0;
+        break;
+    case 0x0c: // STA
+    case 0x78: // STB
+    case 0x54: // STCH
+    case 0x14: // STL
+    case 0x7c: // STS
+    case 0x84: // STT
+    case 0x10: // STX
+        uses_value = 0;
+        break;
+    default:
+        return 0;
+    }
+
+    int fallback = JIT_FALLBACK | n << 8;
+    int done = (n + 1) << 8;
+
+    // target address in ecx, operand value in eax
+    mov_ri(e, ECX, disp + (p ? next : 0));
+    if (x) {
+        sign_extend(e, R12);
+        op_rr(e, 0x01, R12, ECX);
+    }
+    if (b) {
+        op_rm(e, 0x03, ECX, reg_offset(3));
+    }
+
+    if (ni == 3) {
+        check_address(e, pc, fallback);
+        if (uses_value) {
+            load_word(e);
+        }
+    } else if (ni == 2) {
+        check_address(e, pc, fallback);
+        load_word(e);
+        mov_rr(e, ECX, EAX);
+        check_address(e, pc, fallback);
+        if (uses_value) {
+            load_word(e);
+        }
+    } else if (uses_value) {
+        mov_rr(e, EAX, ECX);
+    }
+    if (uses_value) {
+        sign_extend(e, EAX);
+    }
+
+    switch (opcode) {
+    case 0x18: // ADD
+        op_rr(e, 0x01, EAX, EBX);
+        break;
+    case 0x40: // AND
+        op_rr(e, 0x21, EAX, EBX);
+        break;
+    case 0x28: // COMP
+        compare(e, EBX, EAX);
+        break;
+    case 0x00: // LDA
+        mov_rr(e, EBX, EAX);
+        break;
+    case 0x68: // LDB
+        store_guest(e, 3, EAX);
+        break;
+    case 0x50: // LDCH
+        op_ri(e, 4, EBX, ~0xff);
+        shr_ri(e, EAX, 16);
+        op_ri(e, 4, EAX, 0xff);
+        op_rr(e, 0x09, EAX, EBX);
+        break;
+    case 0x08: // LDL
+        store_guest(e, 2, EAX);
+        break;
+    case 0x6c: // LDS
+        mov_rr(e, R14, EAX);
+        break;
+    case 0x74: // LDT
+        mov_rr(e, R13, EAX);
+        break;
+    case 0x04: // LDX
+        mov_rr(e, R12, EAX);
+        break;
+    case 0x20: // MUL
+        imul_rr(e, EBX, EAX);
+        break;
+    case 0x44: // OR
+        op_rr(e, 0x09, EAX, EBX);
+        break;
+    case 0x1c: // SUB
+        op_rr(e, 0x29, EAX, EBX);
+        break;
+    case 0xe0: // TD
+        mov_mi(e, reg_offset(9), -1);
+        break;
+    case 0x2c: // TIX
+        op_ri(e, 0, R12, 1);
+        mov_rr(e, ECX, EAX);
+        compare(e, R12, ECX);
+        break;
+
+    case 0x3c: // J
+        store_guest(e, 8, ECX);
+        leave(e, done);
+        break;
+    case 0x30: // JEQ
+    case 0x34: // JGT
+    case 0x38: // JLT
+        mov_ri(e, EDX, next);
+        byte(e, 0x83); // cmp dword [rbp + SW], 0
+        modrm(e, 1, 7, EBP);
+        byte(e, reg_offset(9));
+        byte(e, 0);
+        byte(e, 0x0f); // cmovcc edx, ecx
+        byte(e, 0x40 + (opcode == 0x30 ? CC_E : opcode == 0x34 ? CC_G : CC_L));
+        modrm(e, 3, EDX, ECX);
+        store_guest(e, 8, EDX);
+        leave(e, done);
+        break;
+    case 0x48: // JSUB
+        mov_mi(e, reg_offset(2), next);
+        store_guest(e, 8, ECX);
+        leave(e, done);
+        break;
+    case 0x4c: // RSUB
+        load_guest(e, EAX, 2);
+        store_guest(e, 8, EAX);
+        leave(e, done);
+        break;
+
+    case 0x0c: // STA
+    case 0x78: // STB
+    case 0x14: // STL
+    case 0x7c: // STS
+    case 0x84: // STT
+    case 0x10: // STX
+        check_address(e, pc, fallback);
+        {
+            int r = opcode == 0x0c ? 0 : opcode == 0x78 ? 3 : opcode == 0x14 ? 2 : opcode == 0x7c ? 4 : opcode == 0x84 ? 5 : 1;
+            load_guest(e, EAX, r);
+        }
+        store(e, store_word, EAX, next, done);
+        break;
+    case 0x54: // STCH
+        check_address(e, pc, fallback);
+        mov_rr(e, EAX, EBX);
+        op_ri(e, 4, EAX, 0xff);
+        store(e, store_byte, EAX, next, done);
+        break;
+    }
+    return len;
+}
+
+// saves the guest registers and returns status from eax
+static void emit_epilogue(struct emitter* e)
+{
+    op_rm(e, 0x89, EBX, offsetof(struct registers, A));
+    op_rm(e, 0x89, R12, offsetof(struct registers, X));
+    op_rm(e, 0x89, R13, offsetof(struct registers, T));
+    op_rm(e, 0x89, R14, offsetof(struct registers, S));
+    byte(e, 0x48); // add rsp, 8
+    byte(e, 0x83);
+    byte(e, 0xc4);
+    byte(e, 8);
+    pop(e, R15);
+    pop(e, R14);
+    pop(e, R13);
+    pop(e, R12);
+    pop(e, EBP);
+    pop(e, EBX);
+    byte(e, 0xc3);
+}
+
+static void emit_prologue(struct emitter* e)
+{
+    push(e, EBX);
+    push(e, EBP);
+    push(e, R12);
+    push(e, R13);
+    push(e, R14);
+    push(e, R15);
+    byte(e, 0x48); // sub rsp, 8
+    byte(e, 0x83);
+    byte(e, 0xec);
+    byte(e, 8);
+    byte(e, 0x48); // mov rbp, rsi
+    byte(e, 0x89);
+    byte(e, 0xf5);
+    byte(e, 0x49); // mov r15, rdi
+    byte(e, 0x89);
+    byte(e, 0xff);
+    op_rm(e, 0x8b, EBX, offsetof(struct registers, A));
+    op_rm(e, 0x8b, R12, offsetof(struct registers, X));
+    op_rm(e, 0x8b, R13, offsetof(struct registers, T));
+    op_rm(e, 0x8b, R14, offsetof(struct registers, S));
+}
+
+static void cover(int addr, int len);
+
+static int is_format_2(int opcode)
+{
+    return opcode >= 0x90 && opcode <= 0xb8;
+}
+
+static jit_block translate(int start)
+{
+    if (code_len + BLOCK_ROOM > CODE_SIZE) {
+        jit_flush();
+    }
+
+    // the epilogue goes first so that every exit is a backward jump
+    struct emitter e = { code + code_len, code + code_len };
+    emit_epilogue(&e);
+    jit_block entry = (jit_block)(void*)e.p;
+    emit_prologue(&e);
+
+    int pc = start, n = 0, ends = 0;
+    while (n < JIT_MAX_BLOCK && !ends && pc + 4 <= MEMORY_SIZE) {
+        // the run loop must see every breakpoint
+        if (n > 0 && env.is_breakpoint(pc)) {
+            break;
+        }
+
+        int opcode = env.mem[pc] & 0xfc;
+        int len = is_format_2(opcode) ? translate_format_2(&e, pc) : translate_format_3_4(&e, pc, n, &ends);
+        if (!len) {
+            break;
+        }
+
+        cover(pc, len);
+        pc += len;
+        n++;
+    }
+
+    if (n == 0) {
+        return NULL;
+    }
+    if (!ends) {
+        leave_at(&e, pc, n << 8);
+    }
+
+    code_len = (int)(e.p - code);
+    return entry;
+}
+
+int jit_init(const struct jit_env* e)
+{
+    if (code) {
+        return 0;
+    }
+
+    void* p = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+
+    env = *e;
+    code = p;
+    code_len = 0;
+    return 0;
+}
+
+// marks addresses whose first instruction cannot be translated
+static int untranslated(unsigned char* mem, struct registers* reg)
+{
+    (void)mem;
+    (void)reg;
+    return JIT_FALLBACK;
+}
+
+static void cover(int addr, int len)
+{
+    memset(covered + addr, 1, len);
+    if (addr < covered_lo) {
+        covered_lo = addr;
+    }
+    if (addr + len > covered_hi) {
+        covered_hi = addr + len;
+    }
+}
+
+jit_block jit_lookup(int addr)
+{
+    jit_block* page = blocks[addr >> PAGE_BITS];
+    if (!page) {
+        page = blocks[addr >> PAGE_BITS] = calloc(1 << PAGE_BITS, sizeof(jit_block));
+    }
+
+    jit_block* block = &page[addr & ((1 << PAGE_BITS) - 1)];
+    if (!*block) {
+        *block = translate(addr);
+        if (!*block) {
+            // not tried again until its bytes change
+            *block = untranslated;
+            cover(addr, addr + 4 <= MEMORY_SIZE ? 4 : MEMORY_SIZE - addr);
+        }
+    }
+    return *block == untranslated ? NULL : *block;
+}
+
+void jit_invalidate(int addr, int len)
+{
+    int start = addr > covered_lo ? addr : covered_lo;
+    int end = addr + len < covered_hi ? addr + len : covered_hi;
+    for (int i = start; i < end; ++i) {
+        if (covered[i]) {
+            jit_flush();
+            return;
+        }
+    }
+}
+
+void jit_flush(void)
+{
+    if (!code) {
+        return;
+    }
+
+    for (int i = 0; i < MEMORY_SIZE >> PAGE_BITS; ++i) {
+        if (blocks[i]) {
+            memset(blocks[i], 0, sizeof(jit_block) << PAGE_BITS);
+        }
+    }
+    if (covered_lo < covered_hi) {
+        memset(covered + covered_lo, 0, covered_hi - covered_lo);
+    }
+    covered_lo = MEMORY_SIZE;
+    covered_hi = 0;
+
+    // the block that made the store may still be running; its code is
+    // only overwritten by the next translation
+    code_len = 0;
+    flushed = 1;
+}
+
+#else
+
+int jit_init(const struct jit_env* e)
+{
+    (void)e;
+    return -1;
+}
+
+jit_block jit_lookup(int addr)
+{
+    (void)addr;
+    return NULL;
+}
+
+void jit_invalidate(int addr, int len)
+{
+    (void)addr;
+    (void)len;
+}
+
+void jit_flush(void)
+{
+}
+
+#endif
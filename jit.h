@@ -0,0 +1,35 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "machine.h"
+
+// longest block in instructions
+#define JIT_MAX_BLOCK 64
+
+// a block returns the number of instructions it ran shifted left by 8,
+// ORed with JIT_FALLBACK if it stopped before one that the interpreter
+// has to run
+#define JIT_FALLBACK 1
+
+typedef int (*jit_block)(unsigned char* mem, struct registers* reg);
+
+struct jit_env {
+    unsigned char* mem;
+    int (*is_breakpoint)(int addr);
+    // stores made by translated code; they must call jit_invalidate
+    void (*store)(int addr, int val);
+    void (*store_byte)(int addr, int val);
+};
+
+// returns -1 if translated code cannot run on this host
+int jit_init(const struct jit_env* env);
+
+// block starting at addr, translated on first use; NULL if the
+// instruction at addr must be run by the interpreter
+jit_block jit_lookup(int addr);
+
+// drops all blocks if translated code covers a byte in [addr, addr + len)
+void jit_invalidate(int addr, int len);
+void jit_flush(void);
+
+#endif // JIT_H
@@ -0,0 +1,21 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+// size of the simulated memory in bytes
+#define MEMORY_SIZE (16 * 65536)
+
+// granularity of dirty tracking and of pages shared by snapshots
+#define MEMORY_PAGE 4096
+
+struct registers {
+    int A;
+    int X;
+    int L;
+    int PC;
+    int B;
+    int S;
+    int T;
+    int SW;
+};
+
+#endif // MACHINE_H
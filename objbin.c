@@ -0,0 +1,365 @@
+#include "objbin.h"
+#include "machine.h"
+#include "objrec.h"
+#include "outbuf.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// bytes per T record written by objbin_to_text, as written by assemble
+#define TEXT_RECORD_BYTES 30
+
+static int valid_name(const char* name)
+{
+    return name[0] && memchr(name, 0, OBJREC_NAME + 1) && !name[7];
+}
+
+int objbin_open(const char* file, struct objbin* obj)
+{
+    obj->map = NULL;
+
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    char magic[8];
+    if (fstat(fd, &st) == -1 || read(fd, magic, 8) != 8 || memcmp(magic, OBJBIN_MAGIC, 8) != 0) {
+        close(fd);
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(struct objbin_header)) {
+        close(fd);
+        return -2;
+    }
+
+    obj->size = (size_t)st.st_size;
+    obj->map = mmap(NULL, obj->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (obj->map == MAP_FAILED) {
+        obj->map = NULL;
+        return -1;
+    }
+
+    const struct objbin_header* h = obj->header = obj->map;
+    const char* p = (const char*)obj->map + sizeof(*h);
+    uint64_t tables = (uint64_t)h->ndefs * sizeof(struct objbin_symbol) + (uint64_t)h->nrefs * sizeof(struct objbin_symbol)
+        + (uint64_t)h->nmodify * sizeof(struct objbin_modify) + (uint64_t)h->nsegments * sizeof(struct objbin_segment);
+    // start and length have the 6 hex digits of an H record, and the
+    // section fits in memory
+    if (h->version != OBJBIN_VERSION || !valid_name(h->name) || h->start > 0xffffff || h->length > MEMORY_SIZE
+        || sizeof(*h) + tables + h->size != obj->size) {
+        objbin_close(obj);
+        return -2;
+    }
+    obj->defs = (const struct objbin_symbol*)p;
+    obj->refs = obj->defs + h->ndefs;
+    obj->modifys = (const struct objbin_modify*)(obj->refs + h->nrefs);
+    obj->segments = (const struct objbin_segment*)(obj->modifys + h->nmodify);
+    obj->text = (const unsigned char*)(obj->segments + h->nsegments);
+
+    // so that a loader can use the entries without checking them; their
+    // addresses are those the section was assembled at
+    int bad = 0;
+    for (uint32_t i = 0; i < h->ndefs; ++i) {
+        bad |= !valid_name(obj->defs[i].name);
+    }
+    for (uint32_t i = 0; i < h->nrefs; ++i) {
+        bad |= !valid_name(obj->refs[i].name) || obj->refs[i].value > 0xff;
+    }
+    for (uint32_t i = 0; i < h->nmodify; ++i) {
+        const struct objbin_modify* mod = &obj->modifys[i];
+        bad |= mod->addr < h->start || (uint64_t)mod->addr - h->start + 3 > h->length || (mod->sign != 1 && mod->sign != -1);
+    }
+    for (uint32_t i = 0; i < h->nsegments; ++i) {
+        const struct objbin_segment* s = &obj->segments[i];
+        bad |= s->addr < h->start || (uint64_t)s->addr - h->start + s->len > h->length
+            || (uint64_t)s->offset + s->len > h->size;
+    }
+    if (bad) {
+        objbin_close(obj);
+        return -2;
+    }
+    return 0;
+}
+
+void objbin_close(struct objbin* obj)
+{
+    if (obj->map) {
+        munmap(obj->map, obj->size);
+        obj->map = NULL;
+    }
+}
+
+static void copy_name(char* out, const char* name)
+{
+    memset(out, 0, 8);
+    memcpy(out, name, strnlen(name, OBJREC_NAME));
+}
+
+void objbin_init(struct objbin_builder* b, const char* name, int start, int length)
+{
+    memset(b, 0, sizeof(*b));
+    memcpy(b->header.magic, OBJBIN_MAGIC, 8);
+    b->header.version = OBJBIN_VERSION;
+    copy_name(b->header.name, name);
+    b->header.start = start;
+    b->header.length = length;
+    b->header.entry = OBJBIN_NONE;
+}
+
+void objbin_free(struct objbin_builder* b)
+{
+    free(b->defs);
+    free(b->refs);
+    free(b->modifys);
+    free(b->segments);
+    free(b->text);
+}
+
+// makes room for one more of n entries of size bytes
+static void* grow(void* p, int* cap, uint32_t n, size_t size)
+{
+    if ((int)n < *cap) {
+        return p;
+    }
+    *cap = *cap ? *cap * 2 : 16;
+    return realloc(p, size * *cap);
+}
+
+void objbin_add_def(struct objbin_builder* b, const char* name, int addr)
+{
+    b->defs = grow(b->defs, &b->capdefs, b->header.ndefs, sizeof(struct objbin_symbol));
+    struct objbin_symbol* def = &b->defs[b->header.ndefs++];
+    copy_name(def->name, name);
+    def->value = addr;
+}
+
+void objbin_add_ref(struct objbin_builder* b, int idx, const char* name)
+{
+    b->refs = grow(b->refs, &b->caprefs, b->header.nrefs, sizeof(struct objbin_symbol));
+    struct objbin_symbol* ref = &b->refs[b->header.nrefs++];
+    copy_name(ref->name, name);
+    ref->value = idx;
+}
+
+void objbin_add_modify(struct objbin_builder* b, int addr, int len, int idx, int sign)
+{
+    b->modifys = grow(b->modifys, &b->capmodify, b->header.nmodify, sizeof(struct objbin_modify));
+    b->modifys[b->header.nmodify++] = (struct objbin_modify) { addr, (uint8_t)len, (uint8_t)idx, (int8_t)sign, 0 };
+}
+
+void objbin_add_text(struct objbin_builder* b, int addr, const unsigned char* bytes, int len)
+{
+    if (len == 0) {
+        return;
+    }
+
+    struct objbin_segment* last = b->header.nsegments ? &b->segments[b->header.nsegments - 1] : NULL;
+    if (!last || last->addr + last->len != (uint32_t)addr) {
+        b->segments = grow(b->segments, &b->capsegments, b->header.nsegments, sizeof(struct objbin_segment));
+        last = &b->segments[b->header.nsegments++];
+        *last = (struct objbin_segment) { addr, 0, b->header.size };
+    }
+
+    while ((int)b->header.size + len > b->capsize) {
+        b->capsize = b->capsize ? b->capsize * 2 : 4096;
+        b->text = realloc(b->text, b->capsize);
+    }
+    memcpy(b->text + b->header.size, bytes, len);
+    b->header.size += len;
+    last->len += len;
+}
+
+int objbin_write(const struct objbin_builder* b, const char* file)
+{
+    FILE* fp = fopen(file, "wb");
+    if (!fp) {
+        return -1;
+    }
+
+    const struct objbin_header* h = &b->header;
+    fwrite(h, sizeof(*h), 1, fp);
+    fwrite(b->defs, sizeof(struct objbin_symbol), h->ndefs, fp);
+    fwrite(b->refs, sizeof(struct objbin_symbol), h->nrefs, fp);
+    fwrite(b->modifys, sizeof(struct objbin_modify), h->nmodify, fp);
+    fwrite(b->segments, sizeof(struct objbin_segment), h->nsegments, fp);
+    fwrite(b->text, 1, h->size, fp);
+
+    // a failed fwrite is only remembered in the stream
+    int error = ferror(fp);
+    return fclose(fp) == 0 && !error ? 0 : -1;
+}
+
+int objbin_from_text(FILE* out, const char* in, const char* file)
+{
+    FILE* fp = fopen(in, "r");
+    if (!fp) {
+        fprintf(out, "Error: error opening file %s\n", in);
+        return -1;
+    }
+
+    // long enough for a text record of 255 bytes
+    char line[1024];
+    struct objrec_header header;
+    if (!fgets(line, sizeof(line), fp) || objrec_header(line, &header) == -1) {
+        fprintf(out, "Error: cannot parse header record\n");
+        fclose(fp);
+        return -1;
+    }
+
+    struct objbin_builder b;
+    objbin_init(&b, header.name, header.start, header.length);
+
+    int result = -1;
+    struct objrec_def* defs = NULL;
+    struct objrec_ref* refs = NULL;
+    int ndefs = 0, nrefs = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        int addr, len, entry;
+        unsigned char text[255];
+        struct objrec_modify mod;
+
+        if (line[0] == 'D') {
+            if (objrec_defs(line, &defs, &ndefs) == -1) {
+                fprintf(out, "Error: cannot parse external definition record\n");
+                goto done;
+            }
+        } else if (line[0] == 'R') {
+            if (objrec_refs(line, &refs, &nrefs) == -1) {
+                fprintf(out, "Error: cannot parse external reference record\n");
+                goto done;
+            }
+        } else if (line[0] == 'T') {
+            if (objrec_text(line, &addr, &len) == -1 || objrec_bytes(line + OBJREC_TEXT, len, text) == -1) {
+                fprintf(out, "Error: cannot parse text record\n");
+                goto done;
+            }
+            if (addr < header.start || addr - header.start + len > header.length) {
+                fprintf(out, "Error: text record outside of section %s\n", header.name);
+                goto done;
+            }
+            objbin_add_text(&b, addr, text, len);
+        } else if (line[0] == 'M') {
+            if (objrec_modify(line, &mod) == -1) {
+                fprintf(out, "Error: cannot parse modification record\n");
+                goto done;
+            }
+            if (mod.addr < header.start || mod.addr - header.start + 3 > header.length) {
+                fprintf(out, "Error: modification record outside of section %s\n", header.name);
+                goto done;
+            }
+            objbin_add_modify(&b, mod.addr, mod.len, mod.idx, mod.sign);
+        } else if (line[0] == 'E') {
+            if (objrec_end(line, &entry) == -1) {
+                fprintf(out, "Error: cannot parse end record\n");
+                goto done;
+            }
+            b.header.entry = entry == -1 ? OBJBIN_NONE : (uint32_t)entry;
+        }
+    }
+    for (int i = 0; i < ndefs; ++i) {
+        objbin_add_def(&b, defs[i].name, defs[i].addr);
+    }
+    for (int i = 0; i < nrefs; ++i) {
+        objbin_add_ref(&b, refs[i].idx, refs[i].name);
+    }
+
+    if (objbin_write(&b, file) == -1) {
+        fprintf(out, "Error: error writing file %s\n", file);
+        goto done;
+    }
+    result = 0;
+
+done:
+    fclose(fp);
+    free(defs);
+    free(refs);
+    objbin_free(&b);
+    return result;
+}
+
+int objbin_to_text(FILE* out, const char* in, const char* file)
+{
+    struct objbin obj;
+    int result = objbin_open(in, &obj);
+    if (result != 0) {
+        fprintf(out, result == -1 ? "Error: error opening file %s\n" : "Error: %s is not a valid binary object file\n", in);
+        return -1;
+    }
+
+    struct outbuf buf, *ob = &buf;
+    if (outbuf_open(ob, file) == -1) {
+        fprintf(out, "Error: error opening file %s\n", file);
+        objbin_close(&obj);
+        return -1;
+    }
+
+    const struct objbin_header* h = obj.header;
+    outbuf_putc(ob, 'H');
+    outbuf_pad(ob, h->name, (int)strlen(h->name), OBJREC_NAME);
+    outbuf_hex(ob, h->start, 6);
+    outbuf_hex(ob, h->length, 6);
+    outbuf_putc(ob, '\n');
+
+    // five definitions and eight references per line
+    for (uint32_t i = 0; i < h->ndefs; ++i) {
+        if (i % 5 == 0) {
+            outbuf_putc(ob, 'D');
+        }
+        outbuf_pad(ob, obj.defs[i].name, (int)strlen(obj.defs[i].name), OBJREC_NAME);
+        outbuf_hex(ob, obj.defs[i].value, 6);
+        if (i % 5 == 4 || i == h->ndefs - 1) {
+            outbuf_putc(ob, '\n');
+        }
+    }
+    for (uint32_t i = 0; i < h->nrefs; ++i) {
+        if (i % 8 == 0) {
+            outbuf_putc(ob, 'R');
+        }
+        outbuf_hex(ob, obj.refs[i].value, 2);
+        outbuf_pad(ob, obj.refs[i].name, (int)strlen(obj.refs[i].name), OBJREC_NAME);
+        if (i % 8 == 7 || i == h->nrefs - 1) {
+            outbuf_putc(ob, '\n');
+        }
+    }
+
+    for (uint32_t i = 0; i < h->nsegments; ++i) {
+        const struct objbin_segment* s = &obj.segments[i];
+        for (uint32_t j = 0; j < s->len; j += TEXT_RECORD_BYTES) {
+            int len = s->len - j < TEXT_RECORD_BYTES ? (int)(s->len - j) : TEXT_RECORD_BYTES;
+            outbuf_putc(ob, 'T');
+            outbuf_hex(ob, s->addr + j, 6);
+            outbuf_hex(ob, len, 2);
+            outbuf_hex_bytes(ob, obj.text + s->offset + j, len);
+            outbuf_putc(ob, '\n');
+        }
+    }
+
+    for (uint32_t i = 0; i < h->nmodify; ++i) {
+        const struct objbin_modify* mod = &obj.modifys[i];
+        outbuf_putc(ob, 'M');
+        outbuf_hex(ob, mod->addr, 6);
+        outbuf_hex(ob, mod->len, 2);
+        outbuf_putc(ob, mod->sign > 0 ? '+' : '-');
+        outbuf_hex(ob, mod->idx, 2);
+        outbuf_putc(ob, '\n');
+    }
+
+    outbuf_putc(ob, 'E');
+    if (h->entry != OBJBIN_NONE) {
+        outbuf_hex(ob, h->entry, 6);
+    }
+    outbuf_putc(ob, '\n');
+
+    objbin_close(&obj);
+    if (outbuf_close(ob) == -1) {
+        fprintf(out, "Error: error writing file %s\n", file);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef OBJBIN_H
+#define OBJBIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// binary object files: the header, then the definitions, references,
+// modifications and text segments as arrays of fixed-size entries, then
+// the bytes of all segments; in host byte order with every entry 4-byte
+// aligned, so that a mapped file is used in place
+
+#define OBJBIN_MAGIC "SICXEOBJ"
+#define OBJBIN_VERSION 1
+
+// entry of a section that has none
+#define OBJBIN_NONE 0xffffffffu
+
+struct objbin_header {
+    char magic[8];
+    uint32_t version;
+    char name[8];
+    uint32_t start, length;
+    uint32_t entry;
+    uint32_t ndefs, nrefs, nmodify, nsegments;
+    // bytes of text after the arrays
+    uint32_t size;
+};
+
+// names have up to 6 characters and are padded with NULs
+struct objbin_symbol {
+    char name[8];
+    // address of a definition, number of a reference
+    uint32_t value;
+};
+
+struct objbin_modify {
+    uint32_t addr;
+    uint8_t len; // in half bytes
+    uint8_t idx;
+    int8_t sign;
+    uint8_t unused;
+};
+
+struct objbin_segment {
+    uint32_t addr, len;
+    // of the bytes, from the start of the text
+    uint32_t offset;
+};
+
+// a binary object file mapped into memory
+struct objbin {
+    void* map;
+    size_t size;
+    const struct objbin_header* header;
+    const struct objbin_symbol* defs;
+    const struct objbin_symbol* refs;
+    const struct objbin_modify* modifys;
+    const struct objbin_segment* segments;
+    const unsigned char* text;
+};
+
+// maps file and checks that every entry lies inside the file and the
+// section; returns 0, 1 if file is not a binary object file, -1 if it
+// cannot be opened and -2 if it is malformed
+int objbin_open(const char* file, struct objbin* obj);
+void objbin_close(struct objbin* obj);
+
+// collects a section for objbin_write
+struct objbin_builder {
+    struct objbin_header header;
+    int capdefs, caprefs, capmodify, capsegments, capsize;
+    struct objbin_symbol* defs;
+    struct objbin_symbol* refs;
+    struct objbin_modify* modifys;
+    struct objbin_segment* segments;
+    unsigned char* text;
+};
+
+void objbin_init(struct objbin_builder* b, const char* name, int start, int length);
+void objbin_free(struct objbin_builder* b);
+
+void objbin_add_def(struct objbin_builder* b, const char* name, int addr);
+void objbin_add_ref(struct objbin_builder* b, int idx, const char* name);
+void objbin_add_modify(struct objbin_builder* b, int addr, int len, int idx, int sign);
+// text that continues the previous segment is appended to it
+void objbin_add_text(struct objbin_builder* b, int addr, const unsigned char* bytes, int len);
+
+int objbin_write(const struct objbin_builder* b, const char* file);
+
+// convert between the formats, printing errors to out
+int objbin_from_text(FILE* out, const char* in, const char* file);
+int objbin_to_text(FILE* out, const char* in, const char* file);
+
+#endif // OBJBIN_H
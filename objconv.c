@@ -0,0 +1,24 @@
+// converts an object file between the text and the binary format
+#include "objbin.h"
+
+#include <stdio.h>
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s input-obj output-obj\n", argv[0]);
+        return 2;
+    }
+
+    // the output gets the format the input does not have
+    struct objbin obj;
+    int kind = objbin_open(argv[1], &obj);
+    objbin_close(&obj);
+    if (kind == -1) {
+        fprintf(stderr, "Error: error opening file %s\n", argv[1]);
+        return 1;
+    }
+
+    int result = kind == 1 ? objbin_from_text(stderr, argv[1], argv[2]) : objbin_to_text(stderr, argv[1], argv[2]);
+    return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+#include "objrec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// value of a hex digit, -1 for anything else
+static const signed char hex_value[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+// characters before the line ending
+static int line_length(const char* line)
+{
+    return (int)strcspn(line, "\r\n");
+}
+
+int objrec_hex(const char* str, int digits)
+{
+    int val = 0, bad = 0;
+    for (int i = 0; i < digits; ++i) {
+        int d = hex_value[(unsigned char)str[i]];
+        bad |= d;
+        val = val << 4 | (d & 0xf);
+    }
+    return bad < 0 ? -1 : val;
+}
+
+int objrec_bytes(const char* str, int len, unsigned char* out)
+{
+    const unsigned char* p = (const unsigned char*)str;
+    int bad = 0;
+    for (int i = 0; i < len; ++i, p += 2) {
+        int hi = hex_value[p[0]], lo = hex_value[p[1]];
+        bad |= hi | lo;
+        out[i] = (unsigned char)(hi << 4 | (lo & 0xf));
+    }
+    return bad < 0 ? -1 : 0;
+}
+
+// name of up to OBJREC_NAME characters, padded with spaces to the right
+static int read_name(const char* str, int len, char* name)
+{
+    int n = 0;
+    while (n < len && n < OBJREC_NAME && str[n] != ' ') {
+        name[n] = str[n];
+        ++n;
+    }
+    name[n] = 0;
+    for (int i = n; i < len && i < OBJREC_NAME; ++i) {
+        if (str[i] != ' ') {
+            return -1;
+        }
+    }
+    return n ? 0 : -1;
+}
+
+int objrec_header(const char* line, struct objrec_header* header)
+{
+    if (line[0] != 'H' || line_length(line) != 1 + OBJREC_NAME + 12
+        || read_name(line + 1, OBJREC_NAME, header->name) == -1) {
+        return -1;
+    }
+    header->start = objrec_hex(line + 1 + OBJREC_NAME, 6);
+    header->length = objrec_hex(line + 1 + OBJREC_NAME + 6, 6);
+    return header->start == -1 || header->length == -1 ? -1 : 0;
+}
+
+int objrec_defs(const char* line, struct objrec_def** defs, int* n)
+{
+    // name and address per entry
+    int len = line_length(line) - 1;
+    if (line[0] != 'D' || len <= 0 || len % (OBJREC_NAME + 6) != 0) {
+        return -1;
+    }
+
+    int count = len / (OBJREC_NAME + 6);
+    *defs = realloc(*defs, sizeof(struct objrec_def) * (*n + count));
+    const char* p = line + 1;
+    for (int i = 0; i < count; ++i, p += OBJREC_NAME + 6) {
+        struct objrec_def* def = &(*defs)[*n + i];
+        def->addr = objrec_hex(p + OBJREC_NAME, 6);
+        if (read_name(p, OBJREC_NAME, def->name) == -1 || def->addr == -1) {
+            return -1;
+        }
+    }
+    *n += count;
+    return 0;
+}
+
+int objrec_refs(const char* line, struct objrec_ref** refs, int* n)
+{
+    // reference number and name per entry; the last name may have lost
+    // its padding
+    int len = line_length(line) - 1;
+    if (line[0] != 'R' || len <= 2) {
+        return -1;
+    }
+
+    int count = (len + 2 + OBJREC_NAME - 1) / (2 + OBJREC_NAME);
+    *refs = realloc(*refs, sizeof(struct objrec_ref) * (*n + count));
+    const char* p = line + 1;
+    for (int i = 0; i < count; ++i, p += 2 + OBJREC_NAME, len -= 2 + OBJREC_NAME) {
+        struct objrec_ref* ref = &(*refs)[*n + i];
+        ref->idx = objrec_hex(p, 2);
+        if (len < 3 || ref->idx == -1 || read_name(p + 2, len - 2, ref->name) == -1) {
+            return -1;
+        }
+    }
+    *n += count;
+    return 0;
+}
+
+int objrec_text(const char* line, int* addr, int* len)
+{
+    if (line[0] != 'T' || line_length(line) < OBJREC_TEXT) {
+        return -1;
+    }
+    *addr = objrec_hex(line + 1, 6);
+    *len = objrec_hex(line + 7, 2);
+    if (*addr == -1 || *len == -1 || line_length(line) != OBJREC_TEXT + 2 * *len) {
+        return -1;
+    }
+    return 0;
+}
+
+int objrec_modify(const char* line, struct objrec_modify* modify)
+{
+    int len = line_length(line);
+    if (line[0] != 'M' || (len != 9 && len != 12)) {
+        return -1;
+    }
+    modify->addr = objrec_hex(line + 1, 6);
+    modify->len = objrec_hex(line + 7, 2);
+    if (modify->addr == -1 || modify->len == -1) {
+        return -1;
+    }
+
+    if (len == 9) {
+        modify->sign = 1;
+        modify->idx = 0x01;
+        return 0;
+    }
+    if (line[9] != '+' && line[9] != '-') {
+        return -1;
+    }
+    modify->sign = line[9] == '+' ? 1 : -1;
+    modify->idx = objrec_hex(line + 10, 2);
+    return modify->idx == -1 ? -1 : 0;
+}
+
+int objrec_end(const char* line, int* entry)
+{
+    int len = line_length(line);
+    if (line[0] != 'E' || (len != 1 && len != 7)) {
+        return -1;
+    }
+    *entry = len == 1 ? -1 : objrec_hex(line + 1, 6);
+    return len == 7 && *entry == -1 ? -1 : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef OBJREC_H
+#define OBJREC_H
+
+// decoding of the fixed-width object records (H D R T M E lines) read by
+// the loader; every function takes one line, with or without its newline,
+// and returns 0 or -1 if the line is malformed
+
+#define OBJREC_NAME 6
+
+// where the bytes of a T record start
+#define OBJREC_TEXT 9
+
+struct objrec_header {
+    char name[OBJREC_NAME + 1];
+    int start, length;
+};
+
+struct objrec_def {
+    char name[OBJREC_NAME + 1];
+    int addr;
+};
+
+struct objrec_ref {
+    char name[OBJREC_NAME + 1];
+    int idx;
+};
+
+struct objrec_modify {
+    int addr, len, idx;
+    int sign;
+};
+
+// value of digits hex digits, or -1 if one of them is not a hex digit
+int objrec_hex(const char* str, int digits);
+
+// decodes len bytes from 2 * len hex digits; out may be written to even
+// when the digits turn out to be bad
+int objrec_bytes(const char* str, int len, unsigned char* out);
+
+int objrec_header(const char* line, struct objrec_header* header);
+
+// appends the definitions or references of the line to *defs or *refs,
+// which hold *n entries and grow with realloc
+int objrec_defs(const char* line, struct objrec_def** defs, int* n);
+int objrec_refs(const char* line, struct objrec_ref** refs, int* n);
+
+// address and length of a T record whose len bytes, checked to be all
+// there, follow at line + OBJREC_TEXT
+int objrec_text(const char* line, int* addr, int* len);
+
+// a record without a reference number adds the section address (+01)
+int objrec_modify(const char* line, struct objrec_modify* modify);
+
+// entry is -1 if the E record has no address
+int objrec_end(const char* line, int* entry);
+
+#endif // OBJREC_H
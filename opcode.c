@@ -1,109 +1,45 @@
 #include "opcode.h"
+#include "opcode_hash.h"
 
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
-#define HASH_TABLE_SIZE 20
+// generated from opcode.txt at build time
+#include "opcode_table.h"
 
-struct node {
-    char mnemonic[10];
-    int opcode;
-    enum op_format format;
-    struct node* next;
-};
+// number of buckets shown by opcodelist
+#define LIST_BUCKETS 20
 
-static struct head {
-    struct node* first;
-    struct node* last;
-} hash_table[HASH_TABLE_SIZE];
-
-static int hash(const char* string)
+const struct opcode_info* lookup_opcode(const char* mnemonic, int len)
 {
-    unsigned long long hash = 0x9522ff583c788efe;
-    for (int i = 0; string[i]; ++i) {
-        hash += string[i];
-        hash ^= hash << 13;
-        hash ^= hash >> 7;
-        hash ^= hash << 17;
+    const struct opcode_info* info = &opcode_table[opcode_hash(mnemonic, len, OPCODE_HASH_SEED, OPCODE_TABLE_SIZE)];
+    if (info->len == len && memcmp(info->mnemonic, mnemonic, len) == 0) {
+        return info;
     }
-    return hash % HASH_TABLE_SIZE;
-}
 
-static void add_to_hash_table(const char* mnemonic, int opcode, enum op_format format)
-{
-    struct head* h = &hash_table[hash(mnemonic)];
-    for (struct node* p = h->first; p; p = p->next) {
-        if (strcmp(p->mnemonic, mnemonic) == 0) {
-            // string already in table
-            return;
-        }
-    }
-
-    struct node* node = malloc(sizeof(struct node));
-    strcpy(node->mnemonic, mnemonic);
-    node->opcode = opcode;
-    node->format = format;
-    node->next = NULL;
-
-    if (!h->first) {
-        h->last = h->first = node;
-    } else {
-        h->last->next = node;
-        h->last = node;
-    }
+    return NULL;
 }
 
-void initialize_hash_table(void)
+int find_opcode(const char* mnemonic)
 {
-    FILE* fp = fopen("opcode.txt", "r");
-    if (!fp) {
-        printf("Error: Cannot open opcode.txt\n");
-        exit(1);
-    }
-
-    int opcode;
-    char mnemonic[10], format[10];
-    while (fscanf(fp, "%x %9s %9s", &opcode, mnemonic, format) == 3) {
-        enum op_format fmt;
-        if (strcmp(format, "1") == 0) {
-            fmt = FORMAT_1;
-        } else if (strcmp(format, "2") == 0) {
-            fmt = FORMAT_2;
-        } else if (strcmp(format, "3/4") == 0) {
-            fmt = FORMAT_3_4;
-        } else {
-            printf("Invalid format: %s\n", format);
-            break;
-        }
-
-        add_to_hash_table(mnemonic, opcode, fmt);
-    }
-    fclose(fp);
+    const struct opcode_info* info = lookup_opcode(mnemonic, (int)strlen(mnemonic));
+    return info ? info->opcode : -1;
 }
 
-int find_opcode(const char* mnemonic)
+const char* opcode_mnemonic(int opcode)
 {
-    struct head* h = &hash_table[hash(mnemonic)];
-    for (struct node* p = h->first; p; p = p->next) {
-        if (strcmp(p->mnemonic, mnemonic) == 0) {
-            return p->opcode;
+    const int count = sizeof(opcode_order) / sizeof(opcode_order[0]);
+    for (int i = 0; i < count; ++i) {
+        if (opcode_table[opcode_order[i]].opcode == opcode) {
+            return opcode_table[opcode_order[i]].mnemonic;
         }
     }
-
-    return -1;
+    return NULL;
 }
 
-enum op_format find_op_format(const char* mnemonic)
+unsigned long long opcode_table_fingerprint(void)
 {
-    struct head* h = &hash_table[hash(mnemonic)];
-    for (struct node* p = h->first; p; p = p->next) {
-        if (strcmp(p->mnemonic, mnemonic) == 0) {
-            return p->format;
-        }
-    }
-
-    return FORMAT_NOT_FOUND;
+    return OPCODE_TABLE_FINGERPRINT;
 }
 
 void opcode(const char* cmd)
@@ -122,6 +58,18 @@ void opcode(const char* cmd)
     printf("opcode is %02X\n", result);
 }
 
+static int list_bucket(const char* string)
+{
+    unsigned long long hash = 0x9522ff583c788efe;
+    for (int i = 0; string[i]; ++i) {
+        hash += string[i];
+        hash ^= hash << 13;
+        hash ^= hash >> 7;
+        hash ^= hash << 17;
+    }
+    return hash % LIST_BUCKETS;
+}
+
 void opcodelist(const char* cmd)
 {
     char ch;
@@ -130,11 +78,18 @@ void opcodelist(const char* cmd)
         return;
     }
 
-    for (int i = 0; i < HASH_TABLE_SIZE; ++i) {
+    const int count = sizeof(opcode_order) / sizeof(opcode_order[0]);
+
+    // keep the bucket layout of the original chained table
+    for (int i = 0; i < LIST_BUCKETS; ++i) {
         printf("%d : ", i);
 
         int flag = 0;
-        for (struct node* p = hash_table[i].first; p; p = p->next) {
+        for (int j = 0; j < count; ++j) {
+            const struct opcode_info* p = &opcode_table[opcode_order[j]];
+            if (list_bucket(p->mnemonic) != i) {
+                continue;
+            }
             if (flag) {
                 printf(" -> ");
             }
@@ -145,15 +100,3 @@ void opcodelist(const char* cmd)
         puts("");
     }
 }
-
-void free_opcode_table(void)
-{
-    for (int i = 0; i < HASH_TABLE_SIZE; ++i) {
-        for (struct node* p = hash_table[i].first; p;) {
-            struct node* next = p->next;
-            free(p);
-            p = next;
-        }
-    }
-}
-
@@ -1,22 +1,33 @@
 #ifndef OPCODE_H
 #define OPCODE_H
 
-void initialize_hash_table(void);
-
 void opcodelist(const char* cmd);
 
 void opcode(const char* cmd);
 
-int find_opcode(const char* mnemonic);
-
 enum op_format {
     FORMAT_1,
     FORMAT_2,
     FORMAT_3_4,
     FORMAT_NOT_FOUND = -1
 };
-enum op_format find_op_format(const char* mnemonic);
 
-void free_opcode_table(void);
+struct opcode_info {
+    const char* mnemonic;
+    int len;
+    int opcode;
+    enum op_format format;
+};
+
+// looks up a mnemonic of len characters, NULL if there is no such instruction
+const struct opcode_info* lookup_opcode(const char* mnemonic, int len);
+
+int find_opcode(const char* mnemonic);
+
+// mnemonic of an opcode byte with the n and i bits cleared, NULL if unknown
+const char* opcode_mnemonic(int opcode);
+
+// changes whenever opcode.txt changes
+unsigned long long opcode_table_fingerprint(void);
 
 #endif
@@ -0,0 +1,17 @@
+#ifndef OPCODE_HASH_H
+#define OPCODE_HASH_H
+
+// shared by gen_opcode.c and opcode.c so that the generated table and
+// the lookup agree on where every mnemonic lives
+static inline unsigned opcode_hash(const char* string, int len, unsigned seed, unsigned size)
+{
+    unsigned long long hash = 0xcbf29ce484222325ull ^ seed;
+    for (int i = 0; i < len; ++i) {
+        hash ^= (unsigned char)string[i];
+        hash *= 0x100000001b3ull;
+    }
+    hash ^= hash >> 29;
+    return (unsigned)(hash & (size - 1));
+}
+
+#endif // OPCODE_HASH_H
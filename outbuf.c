@@ -0,0 +1,162 @@
+#include "outbuf.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUTBUF_SIZE (256 * 1024)
+
+// "00" "01" ... "FF"
+static const char hex_pairs[512 + 1] =
+    "000102030405060708090A0B0C0D0E0F"
+    "101112131415161718191A1B1C1D1E1F"
+    "202122232425262728292A2B2C2D2E2F"
+    "303132333435363738393A3B3C3D3E3F"
+    "404142434445464748494A4B4C4D4E4F"
+    "505152535455565758595A5B5C5D5E5F"
+    "606162636465666768696A6B6C6D6E6F"
+    "707172737475767778797A7B7C7D7E7F"
+    "808182838485868788898A8B8C8D8E8F"
+    "909192939495969798999A9B9C9D9E9F"
+    "A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+    "B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+    "C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+    "D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+    "E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+    "F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+int outbuf_open(struct outbuf* out, const char* file)
+{
+    out->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out->fd == -1) {
+        return -1;
+    }
+    out->len = 0;
+    out->error = 0;
+    out->buf = malloc(OUTBUF_SIZE);
+    return 0;
+}
+
+static void write_all(struct outbuf* out, const char* data, int len)
+{
+    while (len > 0) {
+        ssize_t n = write(out->fd, data, len);
+        if (n <= 0) {
+            out->error = 1;
+            return;
+        }
+        data += n;
+        len -= (int)n;
+    }
+}
+
+static void flush(struct outbuf* out)
+{
+    write_all(out, out->buf, out->len);
+    out->len = 0;
+}
+
+// makes room for n more bytes, n <= OUTBUF_SIZE
+static char* reserve(struct outbuf* out, int n)
+{
+    if (out->len + n > OUTBUF_SIZE) {
+        flush(out);
+    }
+    return out->buf + out->len;
+}
+
+int outbuf_close(struct outbuf* out)
+{
+    flush(out);
+    free(out->buf);
+    if (close(out->fd) == -1) {
+        out->error = 1;
+    }
+    return out->error ? -1 : 0;
+}
+
+void outbuf_write(struct outbuf* out, const char* str, int len)
+{
+    if (len > OUTBUF_SIZE / 2) {
+        flush(out);
+        write_all(out, str, len);
+        return;
+    }
+    memcpy(reserve(out, len), str, len);
+    out->len += len;
+}
+
+void outbuf_puts(struct outbuf* out, const char* str)
+{
+    outbuf_write(out, str, (int)strlen(str));
+}
+
+void outbuf_putc(struct outbuf* out, char ch)
+{
+    *reserve(out, 1) = ch;
+    out->len++;
+}
+
+void outbuf_pad(struct outbuf* out, const char* str, int len, int width)
+{
+    outbuf_write(out, str, len);
+    for (int i = len; i < width; ++i) {
+        outbuf_putc(out, ' ');
+    }
+}
+
+void outbuf_dec(struct outbuf* out, int val, int width)
+{
+    char tmp[16];
+    int n = 0;
+    unsigned u = val < 0 ? 0u - (unsigned)val : (unsigned)val;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (val < 0) {
+        tmp[n++] = '-';
+    }
+
+    char* p = reserve(out, (width > n ? width : n));
+    for (int i = n; i < width; ++i) {
+        *p++ = ' ';
+    }
+    for (int i = n - 1; i >= 0; --i) {
+        *p++ = tmp[i];
+    }
+    out->len += width > n ? width : n;
+}
+
+void outbuf_hex(struct outbuf* out, unsigned val, int digits)
+{
+    int n = 1;
+    while (n < 8 && (val >> (4 * n))) {
+        n++;
+    }
+    if (n < digits) {
+        n = digits;
+    }
+
+    char* p = reserve(out, n);
+    for (int i = n - 1; i >= 0; --i) {
+        p[i] = hex_pairs[2 * (val & 0xf) + 1]; // second digit of "0N"
+        val >>= 4;
+    }
+    out->len += n;
+}
+
+void outbuf_hex_bytes(struct outbuf* out, const unsigned char* bytes, int len)
+{
+    while (len > 0) {
+        int n = len > OUTBUF_SIZE / 2 ? OUTBUF_SIZE / 2 : len;
+        char* p = reserve(out, 2 * n);
+        for (int i = 0; i < n; ++i) {
+            memcpy(p + 2 * i, hex_pairs + 2 * bytes[i], 2);
+        }
+        out->len += 2 * n;
+        bytes += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+// buffered writer for large generated files (listings, object files)
+// that formats numbers itself and flushes with plain write(2) calls
+struct outbuf {
+    int fd;
+    int len;
+    int error;
+    char* buf;
+};
+
+int outbuf_open(struct outbuf* out, const char* file);
+int outbuf_close(struct outbuf* out);
+
+void outbuf_write(struct outbuf* out, const char* str, int len);
+void outbuf_puts(struct outbuf* out, const char* str);
+void outbuf_putc(struct outbuf* out, char ch);
+
+// printf("%-*.*s", width, len, str)
+void outbuf_pad(struct outbuf* out, const char* str, int len, int width);
+
+// printf("%*d", width, val)
+void outbuf_dec(struct outbuf* out, int val, int width);
+
+// printf("%0*X", digits, val)
+void outbuf_hex(struct outbuf* out, unsigned val, int digits);
+
+// two upper-case hex digits per byte
+void outbuf_hex_bytes(struct outbuf* out, const unsigned char* bytes, int len);
+
+#endif // OUTBUF_H
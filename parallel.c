@@ -0,0 +1,66 @@
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct work {
+    atomic_int next;
+    int count;
+    void (*job)(void* arg, int i);
+    void* arg;
+};
+
+int parallel_threads(void)
+{
+    const char* env = getenv("SICSIM_THREADS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void* worker(void* p)
+{
+    struct work* w = p;
+    int i;
+    while ((i = atomic_fetch_add(&w->next, 1)) < w->count) {
+        w->job(w->arg, i);
+    }
+    return NULL;
+}
+
+void parallel_for(int count, int nthreads, void (*job)(void* arg, int i), void* arg)
+{
+    struct work w;
+    atomic_init(&w.next, 0);
+    w.count = count;
+    w.job = job;
+    w.arg = arg;
+
+    if (nthreads > count) {
+        nthreads = count;
+    }
+
+    // the calling thread is one of the workers
+    pthread_t* threads = NULL;
+    int started = 0;
+    if (nthreads > 1) {
+        threads = malloc(sizeof(pthread_t) * (nthreads - 1));
+        for (; started < nthreads - 1; ++started) {
+            if (pthread_create(&threads[started], NULL, worker, &w) != 0) {
+                break;
+            }
+        }
+    }
+
+    worker(&w);
+
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
@@ -0,0 +1,11 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// number of worker threads to use, from SICSIM_THREADS or the online CPUs
+int parallel_threads(void);
+
+// calls job(arg, i) for every i in [0, count) using up to nthreads threads
+// and returns when all of them are done
+void parallel_for(int count, int nthreads, void (*job)(void* arg, int i), void* arg);
+
+#endif // PARALLEL_H
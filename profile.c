@@ -0,0 +1,226 @@
+#include "profile.h"
+#include "machine.h"
+#include "opcode.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// number of hottest addresses shown
+#define PROFILE_TOP 10
+
+static unsigned long long total;
+static unsigned long long by_opcode[64];
+static unsigned long long by_format[5];
+static struct timespec started;
+
+// per address, allocated on first use
+static unsigned* by_address;
+static unsigned* taken;
+static unsigned* not_taken;
+
+void profile_start(void)
+{
+    total = 0;
+    memset(by_opcode, 0, sizeof(by_opcode));
+    memset(by_format, 0, sizeof(by_format));
+    if (by_address) {
+        memset(by_address, 0, sizeof(unsigned) * MEMORY_SIZE);
+    }
+    if (taken) {
+        memset(taken, 0, sizeof(unsigned) * MEMORY_SIZE);
+        memset(not_taken, 0, sizeof(unsigned) * MEMORY_SIZE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &started);
+}
+
+void profile_count(int addr, int opcode, int format)
+{
+    if (!by_address) {
+        by_address = calloc(MEMORY_SIZE, sizeof(unsigned));
+    }
+    ++total;
+    ++by_opcode[opcode >> 2];
+    ++by_format[format];
+    ++by_address[addr];
+}
+
+void profile_branch(int addr, int is_taken)
+{
+    if (!taken) {
+        taken = calloc(MEMORY_SIZE, sizeof(unsigned));
+        not_taken = calloc(MEMORY_SIZE, sizeof(unsigned));
+    }
+    if (is_taken) {
+        ++taken[addr];
+    } else {
+        ++not_taken[addr];
+    }
+}
+
+// listing lines that carry an address, read from the .lst next to an object file
+struct listing {
+    char name[100];
+    int n;
+    int* addr;
+    int* line;
+};
+
+// copies file with its extension replaced by ext
+static void replace_extension(char* out, int size, const char* file, const char* ext)
+{
+    const char* slash = strrchr(file, '/');
+    const char* dot = strrchr(file, '.');
+    int len = dot && (!slash || dot > slash) ? (int)(dot - file) : (int)strlen(file);
+    snprintf(out, size, "%.*s%s", len, file, ext);
+}
+
+static void load_listing(const struct profile_source* source, struct listing* l)
+{
+    char file[104], buf[256];
+    replace_extension(file, sizeof(file), source->file, ".lst");
+    replace_extension(l->name, sizeof(l->name), source->file, ".asm");
+    l->n = 0;
+    l->addr = NULL;
+    l->line = NULL;
+
+    FILE* fp = fopen(file, "r");
+    if (!fp) {
+        return;
+    }
+
+    int cap = 0;
+    while (fgets(buf, sizeof(buf), fp)) {
+        // "%4d   %04X   ..." for lines that take up space
+        char* p;
+        long number = strtol(buf, &p, 10);
+        if (p == buf || strncmp(p, "   ", 3) != 0) {
+            continue;
+        }
+        p += 3;
+        int i;
+        for (i = 0; i < 4 && isxdigit((unsigned char)p[i]); ++i) {
+        }
+        if (i < 4 || p[4] != ' ') {
+            continue;
+        }
+
+        if (l->n == cap) {
+            cap = cap ? cap * 2 : 256;
+            l->addr = realloc(l->addr, sizeof(int) * cap);
+            l->line = realloc(l->line, sizeof(int) * cap);
+        }
+        l->addr[l->n] = (int)strtol(p, NULL, 16);
+        // the listing numbers source lines by fives
+        l->line[l->n] = (int)(number / 5);
+        ++l->n;
+    }
+    fclose(fp);
+}
+
+// "file.asm:line" for addr, or "" if no listing covers it
+static void source_line(char* out, int size, const struct profile_source* sources,
+    struct listing* listings, int nsources, int addr)
+{
+    out[0] = 0;
+    for (int i = 0; i < nsources; ++i) {
+        if (addr < sources[i].addr || addr >= sources[i].addr + sources[i].length) {
+            continue;
+        }
+        int found = -1;
+        for (int j = 0; j < listings[i].n; ++j) {
+            // the last line at an address is the one that holds the code
+            if (listings[i].addr[j] == addr - sources[i].addr) {
+                found = j;
+            }
+        }
+        if (found != -1) {
+            snprintf(out, size, "%s:%d", listings[i].name, listings[i].line[found]);
+        }
+        return;
+    }
+}
+
+void profile_report(const struct profile_source* sources, int nsources)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+
+    puts("---------------- profile ----------------");
+    printf("instructions  %llu\n", total);
+    printf("elapsed       %.3f s\n", elapsed);
+    if (elapsed > 0) {
+        printf("per second    %.0f\n", total / elapsed);
+    }
+    for (int i = 1; i <= 4; ++i) {
+        printf("format %d      %llu\n", i, by_format[i]);
+    }
+    if (total == 0) {
+        return;
+    }
+
+    // opcodes by count
+    puts("");
+    puts("opcode    count          %");
+    int shown[64] = { 0 };
+    for (;;) {
+        int best = -1;
+        for (int i = 0; i < 64; ++i) {
+            if (!shown[i] && by_opcode[i] && (best == -1 || by_opcode[i] > by_opcode[best])) {
+                best = i;
+            }
+        }
+        if (best == -1) {
+            break;
+        }
+        shown[best] = 1;
+        const char* name = opcode_mnemonic(best << 2);
+        printf("%-10s%-15llu%5.1f\n", name ? name : "?", by_opcode[best], 100.0 * by_opcode[best] / total);
+    }
+
+    struct listing* listings = malloc(sizeof(struct listing) * (nsources ? nsources : 1));
+    for (int i = 0; i < nsources; ++i) {
+        load_listing(&sources[i], &listings[i]);
+    }
+    char where[128];
+
+    // hottest addresses, kept sorted by count
+    int top[PROFILE_TOP], ntop = 0;
+    for (int addr = 0; addr < MEMORY_SIZE; ++addr) {
+        unsigned count = by_address[addr];
+        if (!count || (ntop == PROFILE_TOP && count <= by_address[top[ntop - 1]])) {
+            continue;
+        }
+        int i = ntop < PROFILE_TOP ? ntop++ : ntop - 1;
+        for (; i > 0 && by_address[top[i - 1]] < count; --i) {
+            top[i] = top[i - 1];
+        }
+        top[i] = addr;
+    }
+    puts("");
+    puts("address   count          %     source");
+    for (int i = 0; i < ntop; ++i) {
+        source_line(where, sizeof(where), sources, listings, nsources, top[i]);
+        printf("%05X     %-15u%5.1f  %s\n", top[i], by_address[top[i]], 100.0 * by_address[top[i]] / total, where);
+    }
+
+    if (taken) {
+        puts("");
+        puts("branch    taken          not taken      source");
+        for (int addr = 0; addr < MEMORY_SIZE; ++addr) {
+            if (taken[addr] || not_taken[addr]) {
+                source_line(where, sizeof(where), sources, listings, nsources, addr);
+                printf("%05X     %-15u%-15u%s\n", addr, taken[addr], not_taken[addr], where);
+            }
+        }
+    }
+
+    for (int i = 0; i < nsources; ++i) {
+        free(listings[i].addr);
+        free(listings[i].line);
+    }
+    free(listings);
+}
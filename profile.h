@@ -0,0 +1,23 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// object file loaded at addr, whose .lst maps addresses back to source lines
+struct profile_source {
+    char file[100];
+    int addr;
+    int length;
+};
+
+// clears the counters and starts the clock
+void profile_start(void);
+
+// one executed instruction at addr; format is 1 to 4
+void profile_count(int addr, int opcode, int format);
+
+// one executed conditional jump at addr
+void profile_branch(int addr, int taken);
+
+// prints the counters gathered since profile_start
+void profile_report(const struct profile_source* sources, int nsources);
+
+#endif // PROFILE_H
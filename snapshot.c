@@ -0,0 +1,92 @@
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct page {
+    int refs;
+    unsigned char data[MEMORY_PAGE];
+};
+
+struct image {
+    int npages;
+    // NULL for a page of zeros
+    struct page* pages[];
+};
+
+static const unsigned char zeros[MEMORY_PAGE];
+
+static int is_dirty(const struct image* base, const unsigned char* dirty, int page)
+{
+    return !base || !dirty || (dirty[page >> 3] >> (page & 7) & 1);
+}
+
+struct image* image_capture(const unsigned char* mem, int size, const struct image* base, const unsigned char* dirty)
+{
+    int npages = size / MEMORY_PAGE;
+    struct image* image = malloc(sizeof(struct image) + sizeof(struct page*) * npages);
+    image->npages = npages;
+
+    for (int i = 0; i < npages; ++i) {
+        const unsigned char* src = mem + i * MEMORY_PAGE;
+        struct page* shared = base ? base->pages[i] : NULL;
+
+        if (!is_dirty(base, dirty, i)) {
+            if (shared) {
+                ++shared->refs;
+            }
+            image->pages[i] = shared;
+        } else if (shared && memcmp(shared->data, src, MEMORY_PAGE) == 0) {
+            ++shared->refs;
+            image->pages[i] = shared;
+        } else if (memcmp(zeros, src, MEMORY_PAGE) == 0) {
+            image->pages[i] = NULL;
+        } else {
+            struct page* page = malloc(sizeof(struct page));
+            page->refs = 1;
+            memcpy(page->data, src, MEMORY_PAGE);
+            image->pages[i] = page;
+        }
+    }
+    return image;
+}
+
+void image_restore(const struct image* image, unsigned char* mem, const struct image* base, const unsigned char* dirty,
+    void (*changed)(void* arg, int addr, int len), void* arg)
+{
+    for (int i = 0; i < image->npages; ++i) {
+        if (!is_dirty(base, dirty, i) && base->pages[i] == image->pages[i]) {
+            continue;
+        }
+        unsigned char* dst = mem + i * MEMORY_PAGE;
+        const unsigned char* src = image->pages[i] ? image->pages[i]->data : zeros;
+        if (memcmp(dst, src, MEMORY_PAGE) != 0) {
+            memcpy(dst, src, MEMORY_PAGE);
+            changed(arg, i * MEMORY_PAGE, MEMORY_PAGE);
+        }
+    }
+}
+
+int image_private_bytes(const struct image* image)
+{
+    int bytes = 0;
+    for (int i = 0; i < image->npages; ++i) {
+        if (image->pages[i] && image->pages[i]->refs == 1) {
+            bytes += MEMORY_PAGE;
+        }
+    }
+    return bytes;
+}
+
+void image_free(struct image* image)
+{
+    if (!image) {
+        return;
+    }
+    for (int i = 0; i < image->npages; ++i) {
+        if (image->pages[i] && --image->pages[i]->refs == 0) {
+            free(image->pages[i]);
+        }
+    }
+    free(image);
+}
@@ -0,0 +1,26 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "machine.h"
+
+// copy of a memory area made of pages that images share while they are
+// equal; all-zero pages take no space
+struct image;
+
+// copies size bytes of mem, a multiple of MEMORY_PAGE, reusing the pages
+// of base (which may be NULL) that hold the same bytes; a page whose bit is
+// clear in dirty (which may be NULL) is known to equal the one in base
+struct image* image_capture(const unsigned char* mem, int size, const struct image* base, const unsigned char* dirty);
+
+// copies the image back into mem, which equals base except in dirty pages
+// as above, and calls changed(arg, ...) for every page whose bytes were
+// different
+void image_restore(const struct image* image, unsigned char* mem, const struct image* base, const unsigned char* dirty,
+    void (*changed)(void* arg, int addr, int len), void* arg);
+
+// bytes held by pages that no other image shares
+int image_private_bytes(const struct image* image);
+
+void image_free(struct image* image);
+
+#endif // SNAPSHOT_H
@@ -1,158 +1,244 @@
 #include "symtab.h"
 
-#define SYMTAB_SIZE 20
+#define SYMTAB_INITIAL_SIZE 32
+#define ARENA_BLOCK_SIZE 4096
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-struct node {
-    char* label;
+struct entry {
+    const char* label;
+    int len;
     int address;
-    struct node* next;
+    unsigned hash;
+};
+
+// labels are copied into large blocks that are freed all at once
+struct arena_block {
+    struct arena_block* next;
+    int used;
+    int size;
+    char data[];
 };
 
 struct symtab_impl {
-    struct table {
-        struct node* first;
-        struct node* last;
-    } table[SYMTAB_SIZE];
+    int* slots; // index into entries, -1 if empty
+    int nslots;
+    struct entry* entries;
+    int nentries;
+    struct arena_block* arena;
+    struct symtab_stats stats;
 };
 
 symtab symtab_init(void)
 {
     symtab table = malloc(sizeof(struct symtab_impl));
-    for (int i = 0; i < SYMTAB_SIZE; ++i) {
-        table->table[i].first = table->table[i].last = NULL;
+    table->nslots = SYMTAB_INITIAL_SIZE;
+    table->slots = malloc(sizeof(int) * table->nslots);
+    for (int i = 0; i < table->nslots; ++i) {
+        table->slots[i] = -1;
     }
+    table->entries = malloc(sizeof(struct entry) * table->nslots);
+    table->nentries = 0;
+    table->arena = NULL;
+    memset(&table->stats, 0, sizeof(table->stats));
 
     return table;
 }
 
-static int hash(const char* string)
+static unsigned hash(const char* string, int len)
 {
-    unsigned long long hash = 0x9522ff583c788efe;
-    for (int i = 0; string[i]; ++i) {
-        hash ^= (string[i] & 0xffull) << 32;
-        hash ^= hash << 13;
-        hash ^= hash >> 7;
-        hash ^= hash << 17;
+    unsigned long long hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < len; ++i) {
+        hash ^= (unsigned char)string[i];
+        hash *= 0x100000001b3ull;
     }
-    return hash % SYMTAB_SIZE;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return (unsigned)hash;
 }
 
-void symtab_insert(symtab tab, const char* label, int address)
+static const char* arena_strdup(symtab tab, const char* str, int len)
+{
+    struct arena_block* b = tab->arena;
+    if (!b || b->used + len + 1 > b->size) {
+        int size = len + 1 > ARENA_BLOCK_SIZE ? len + 1 : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(struct arena_block) + size);
+        b->next = tab->arena;
+        b->used = 0;
+        b->size = size;
+        tab->arena = b;
+    }
+
+    char* p = b->data + b->used;
+    memcpy(p, str, len);
+    p[len] = 0;
+    b->used += len + 1;
+    return p;
+}
+
+// slot holding label, or the empty slot where it would be inserted
+static int probe(const symtab tab, const char* label, int len, unsigned h)
 {
-    struct table* h = &tab->table[hash(label)];
-    for (struct node* p = h->first; p; p = p->next) {
-        if (strcmp(p->label, label) == 0) {
-            // string already in table
-            // update address
-            p->address = address;
-            return;
+    unsigned mask = (unsigned)tab->nslots - 1;
+    unsigned i = h & mask;
+    int n = 1;
+
+    while (tab->slots[i] != -1) {
+        struct entry* e = &tab->entries[tab->slots[i]];
+        if (e->hash == h && e->len == len && memcmp(e->label, label, len) == 0) {
+            break;
         }
+        i = (i + 1) & mask;
+        n++;
     }
 
-    struct node* node = malloc(sizeof(struct node));
-    node->label = malloc(strlen(label) + 1);
-    strcpy(node->label, label);
-    node->address = address;
-    node->next = NULL;
-
-    if (!h->first) {
-        h->last = h->first = node;
-    } else {
-        h->last->next = node;
-        h->last = node;
+    tab->stats.lookups++;
+    tab->stats.probes += n;
+    if (n > 1) {
+        tab->stats.collisions++;
     }
+    if (n > tab->stats.longest_probe) {
+        tab->stats.longest_probe = n;
+    }
+
+    return (int)i;
 }
 
-int symtab_find(const symtab tab, const char* label)
+static void grow(symtab tab)
 {
-    struct table* h = &tab->table[hash(label)];
-    for (struct node* p = h->first; p; p = p->next) {
-        if (strcmp(p->label, label) == 0) {
-            return p->address;
+    int nslots = tab->nslots * 2;
+    int* slots = malloc(sizeof(int) * nslots);
+    for (int i = 0; i < nslots; ++i) {
+        slots[i] = -1;
+    }
+
+    unsigned mask = (unsigned)nslots - 1;
+    for (int j = 0; j < tab->nentries; ++j) {
+        unsigned i = tab->entries[j].hash & mask;
+        while (slots[i] != -1) {
+            i = (i + 1) & mask;
         }
+        slots[i] = j;
     }
 
-    return -1;
+    free(tab->slots);
+    tab->slots = slots;
+    tab->nslots = nslots;
+    tab->entries = realloc(tab->entries, sizeof(struct entry) * nslots);
+    tab->stats.resizes++;
 }
 
-void symtab_free(symtab tab)
+int symtab_intern(symtab tab, const char* label, int len)
 {
-    for (int i = 0; i < SYMTAB_SIZE; ++i) {
-        for (struct node* p = tab->table[i].first; p;) {
-            struct node* next = p->next;
-            free(p->label);
-            free(p);
-            p = next;
-        }
+    unsigned h = hash(label, len);
+    int i = probe(tab, label, len, h);
+
+    if (tab->slots[i] != -1) {
+        return tab->slots[i];
     }
 
-    free(tab);
+    int id = tab->nentries++;
+    struct entry* e = &tab->entries[id];
+    e->label = arena_strdup(tab, label, len);
+    e->len = len;
+    e->address = -1;
+    e->hash = h;
+    tab->slots[i] = id;
+
+    // linear probing degrades quickly past half full
+    if (tab->nentries * 2 >= tab->nslots) {
+        grow(tab);
+    }
+
+    return id;
 }
 
-struct symbol_info {
-    char* label;
-    int address;
-};
+void symtab_define(symtab tab, int id, int address)
+{
+    tab->entries[id].address = address;
+}
 
-static struct symbol_info** symtab_list(symtab tab, int* n)
+int symtab_address(const symtab tab, int id)
 {
-    int size = 0;
-    for (int i = 0; i < SYMTAB_SIZE; ++i) {
-        for (struct node* p = tab->table[i].first; p; p = p->next) {
-            size++;
-        }
+    if (id < 0) {
+        return -1;
     }
+    return tab->entries[id].address;
+}
 
-    struct symbol_info** list = malloc(sizeof(struct symbol_info*) * (size + 1));
-    int j = 0;
-    for (int i = 0; i < SYMTAB_SIZE; ++i) {
-        for (struct node* p = tab->table[i].first; p; p = p->next) {
-            list[j] = malloc(sizeof(struct symbol_info));
-            list[j]->label = malloc(strlen(p->label) + 1);
-            strcpy(list[j]->label, p->label);
-            list[j]->address = p->address;
-            j++;
-        }
-    }
+int symtab_count(const symtab tab)
+{
+    return tab->nentries;
+}
+
+const char* symtab_label(const symtab tab, int id)
+{
+    return tab->entries[id].label;
+}
 
-    list[size] = NULL;
+void symtab_insert(symtab tab, const char* label, int address)
+{
+    symtab_define(tab, symtab_intern(tab, label, (int)strlen(label)), address);
+}
 
-    *n = size;
+int symtab_find(const symtab tab, const char* label)
+{
+    int len = (int)strlen(label);
+    int i = probe(tab, label, len, hash(label, len));
+    if (tab->slots[i] != -1) {
+        return tab->entries[tab->slots[i]].address;
+    }
 
-    return list;
+    return -1;
 }
 
-static void symtab_list_free(struct symbol_info** list)
+void symtab_free(symtab tab)
 {
-    for (int i = 0; list[i]; ++i) {
-        free(list[i]->label);
-        free(list[i]);
+    for (struct arena_block* b = tab->arena; b;) {
+        struct arena_block* next = b->next;
+        free(b);
+        b = next;
     }
-    free(list);
+
+    free(tab->slots);
+    free(tab->entries);
+    free(tab);
+}
+
+void symtab_get_stats(const symtab tab, struct symtab_stats* stats)
+{
+    *stats = tab->stats;
+    stats->symbols = tab->nentries;
+    stats->capacity = tab->nslots;
 }
 
 static int compare_symbol_infos(const void* a, const void* b)
 {
-    struct symbol_info* const* pa = a;
-    struct symbol_info* const* pb = b;
+    struct entry* const* pa = a;
+    struct entry* const* pb = b;
 
     return strcmp((*pb)->label, (*pa)->label);
 }
 
 void print_symtab_list_sorted(symtab tab)
 {
-    int size;
-    struct symbol_info** list = symtab_list(tab, &size);
+    // referenced but never defined symbols are not listed
+    int size = 0;
+    struct entry** list = malloc(sizeof(struct entry*) * (tab->nentries + 1));
+    for (int i = 0; i < tab->nentries; ++i) {
+        if (tab->entries[i].address != -1) {
+            list[size++] = &tab->entries[i];
+        }
+    }
 
-    qsort(list, size, sizeof(struct symbol_info*), compare_symbol_infos);
+    qsort(list, size, sizeof(struct entry*), compare_symbol_infos);
 
     for (int i = 0; i < size; ++i) {
         printf("\t%s\t%04X\n", list[i]->label, list[i]->address);
     }
 
-    symtab_list_free(list);
+    free(list);
 }
@@ -4,10 +4,32 @@
 struct symtab_impl;
 typedef struct symtab_impl* symtab;
 
+struct symtab_stats {
+    int symbols;
+    int capacity;
+    int resizes;
+    long long lookups;
+    long long probes; // slots inspected by all lookups
+    long long collisions; // lookups that had to probe past their home slot
+    int longest_probe;
+};
+
 symtab symtab_init(void);
 void symtab_insert(symtab tab, const char* label, int address);
 int symtab_find(const symtab tab, const char* label);
 void symtab_free(symtab tab);
+
+// dense ids: every label gets the next id the first time it is seen, and
+// stays undefined (address -1) until symtab_define or symtab_insert
+int symtab_intern(symtab tab, const char* label, int len);
+void symtab_define(symtab tab, int id, int address);
+int symtab_address(const symtab tab, int id);
+
+// ids run from 0 to symtab_count(tab) - 1
+int symtab_count(const symtab tab);
+const char* symtab_label(const symtab tab, int id);
+
 void print_symtab_list_sorted(symtab tab);
+void symtab_get_stats(const symtab tab, struct symtab_stats* stats);
 
 #endif // SYMTAB_H
@@ -2,6 +2,7 @@ TEMPLATE = app
 CONFIG += console
 CONFIG -= app_bundle
 CONFIG -= qt
+CONFIG += thread
 
 SOURCES += \
     20171634.c  \
@@ -11,9 +12,38 @@ SOURCES += \
     opcode.c    \
     type.c \
     assemble.c \
-    symtab.c
+    symtab.c \
+    parallel.c \
+    outbuf.c \
+    jit.c \
+    objbin.c \
+    objrec.c \
+    profile.c \
+    snapshot.c \
+    trace.c \
+    undo.c
 
 HEADERS += \
     type.h \
     assemble.h \
-    symtab.h
+    jit.h \
+    machine.h \
+    objbin.h \
+    objrec.h \
+    opcode.h \
+    opcode_hash.h \
+    outbuf.h \
+    parallel.h \
+    profile.h \
+    snapshot.h \
+    symtab.h \
+    trace.h \
+    undo.h
+
+# opcode table is generated from opcode.txt as a perfect hash
+INCLUDEPATH += $$OUT_PWD
+opcode_table.target = opcode_table.h
+opcode_table.commands = gcc -o gen_opcode.out $$PWD/gen_opcode.c && ./gen_opcode.out $$PWD/opcode.txt > opcode_table.h
+opcode_table.depends = $$PWD/gen_opcode.c $$PWD/opcode_hash.h $$PWD/opcode.txt
+QMAKE_EXTRA_TARGETS += opcode_table
+PRE_TARGETDEPS += opcode_table.h
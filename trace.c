@@ -0,0 +1,78 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct trace_record* ring = NULL;
+static uint64_t total = 0;
+static int enabled = 0;
+
+int trace_enabled(void)
+{
+    return enabled;
+}
+
+void trace_add(const struct trace_record* record)
+{
+    ring[total++ & (TRACE_RECORDS - 1)] = *record;
+}
+
+static void trace_dump(const char* file)
+{
+    FILE* fp = fopen(file, "wb");
+    if (!fp) {
+        printf("Error: error opening file %s\n", file);
+        return;
+    }
+
+    struct trace_header header = { TRACE_MAGIC, TRACE_VERSION, sizeof(struct trace_record), total, 0, 0 };
+    header.count = total < TRACE_RECORDS ? (uint32_t)total : TRACE_RECORDS;
+    fwrite(&header, sizeof(header), 1, fp);
+
+    // oldest record first
+    uint32_t first = (uint32_t)(total - header.count) & (TRACE_RECORDS - 1);
+    uint32_t head = header.count < TRACE_RECORDS - first ? header.count : TRACE_RECORDS - first;
+    if (header.count) {
+        fwrite(ring + first, sizeof(struct trace_record), head, fp);
+        fwrite(ring, sizeof(struct trace_record), header.count - head, fp);
+    }
+
+    if (fclose(fp) != 0) {
+        printf("Error: error writing file %s\n", file);
+        return;
+    }
+    printf("\t[ok] %u of %llu records written to %s\n", header.count, (unsigned long long)total, file);
+}
+
+void trace(const char* cmd)
+{
+    char ch, what[10], file[100];
+    int cnt = sscanf(cmd, "%9s %99s %c", what, file, &ch);
+
+    if (cnt == EOF) {
+        printf("\ttrace is %s, %llu records\n", enabled ? "on" : "off", (unsigned long long)total);
+    } else if (cnt == 1 && strcmp(what, "on") == 0) {
+        if (!ring) {
+            ring = malloc(sizeof(struct trace_record) * TRACE_RECORDS);
+        }
+        enabled = 1;
+        total = 0;
+        printf("\t[ok] trace on\n");
+    } else if (cnt == 1 && strcmp(what, "off") == 0) {
+        enabled = 0;
+        printf("\t[ok] trace off\n");
+    } else if (cnt == 2 && strcmp(what, "dump") == 0) {
+        trace_dump(file);
+    } else {
+        printf("Invalid command.\n");
+    }
+}
+
+void free_trace(void)
+{
+    free(ring);
+    ring = NULL;
+    enabled = 0;
+    total = 0;
+}
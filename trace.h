@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// records kept in the ring buffer; a power of two
+#define TRACE_RECORDS 65536
+
+// addr or reg of a record that has none
+#define TRACE_NONE 0xffffffffu
+
+#define TRACE_MAGIC "SICTRACE"
+#define TRACE_VERSION 1
+
+// one executed instruction
+struct trace_record {
+    uint32_t pc;
+    // target address of a format 3/4 instruction
+    uint32_t addr;
+    // new value of reg
+    uint32_t value;
+    uint8_t opcode;
+    // register number as in format 2 operands, the first one that changed
+    uint8_t reg;
+    uint16_t unused;
+};
+
+// start of a file written by trace dump, followed by count records from
+// the oldest to the newest, all in host byte order
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    // instructions traced, of which the last count are in the file
+    uint64_t total;
+    uint32_t count;
+    uint32_t unused;
+};
+
+// trace on|off, trace dump filename
+void trace(const char* cmd);
+void free_trace(void);
+
+int trace_enabled(void);
+void trace_add(const struct trace_record* record);
+
+#endif // TRACE_H
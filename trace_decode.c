@@ -0,0 +1,62 @@
+// prints a file written by the simulator's trace dump command
+#include "opcode.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* register_name(int n)
+{
+    static const char* names[] = { "A", "X", "L", "B", "S", "T", "F", "?", "PC", "SW" };
+    return n < (int)(sizeof(names) / sizeof(names[0])) ? names[n] : "?";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace-file\n", argv[0]);
+        return 2;
+    }
+
+    FILE* fp = fopen(argv[1], "rb");
+    if (!fp) {
+        fprintf(stderr, "error opening file %s\n", argv[1]);
+        return 1;
+    }
+
+    struct trace_header header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, TRACE_MAGIC, 8) != 0
+        || header.version != TRACE_VERSION || header.record_size != sizeof(struct trace_record)) {
+        fprintf(stderr, "%s is not a trace file of this version\n", argv[1]);
+        fclose(fp);
+        return 1;
+    }
+
+    printf("%llu instructions traced, last %u follow\n", (unsigned long long)header.total, header.count);
+
+    // number of the first record among all traced instructions
+    unsigned long long n = header.total - header.count;
+    struct trace_record record;
+    for (unsigned i = 0; i < header.count; ++i, ++n) {
+        if (fread(&record, sizeof(record), 1, fp) != 1) {
+            fprintf(stderr, "%s is truncated\n", argv[1]);
+            fclose(fp);
+            return 1;
+        }
+
+        const char* name = opcode_mnemonic(record.opcode);
+        printf("%-10llu %05X  %-6s", n, record.pc, name ? name : "?");
+        if (record.addr != TRACE_NONE) {
+            printf("  TA=%05X", record.addr & 0xffffff);
+        } else {
+            printf("  %8s", "");
+        }
+        if (record.reg != 0xff) {
+            printf("  %s=%06X", register_name(record.reg), record.value & 0xffffff);
+        }
+        puts("");
+    }
+
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "undo.h"
+
+#include <stdlib.h>
+
+// entries are stored as len, bytes, len so that the ring can be walked
+// from both ends; live entries are in [tail, head)
+static unsigned char* ring = NULL;
+static unsigned long long head = 0;
+static unsigned long long tail = 0;
+static unsigned long long count = 0;
+
+static void put(unsigned char byte)
+{
+    ring[head++ & (UNDO_BYTES - 1)] = byte;
+}
+
+void undo_push(const unsigned char* entry, int len)
+{
+    if (!ring) {
+        ring = malloc(UNDO_BYTES);
+    }
+
+    while (head + len + 2 - tail > UNDO_BYTES) {
+        tail += ring[tail & (UNDO_BYTES - 1)] + 2;
+        --count;
+    }
+
+    put((unsigned char)len);
+    for (int i = 0; i < len; ++i) {
+        put(entry[i]);
+    }
+    put((unsigned char)len);
+    ++count;
+}
+
+int undo_pop(unsigned char* entry)
+{
+    if (head == tail) {
+        return 0;
+    }
+
+    int len = ring[(head - 1) & (UNDO_BYTES - 1)];
+    head -= len + 2;
+    for (int i = 0; i < len; ++i) {
+        entry[i] = ring[(head + 1 + i) & (UNDO_BYTES - 1)];
+    }
+    --count;
+    return len;
+}
+
+unsigned long long undo_count(void)
+{
+    return count;
+}
+
+void undo_clear(void)
+{
+    head = tail = count = 0;
+}
+
+void free_undo(void)
+{
+    free(ring);
+    ring = NULL;
+    undo_clear();
+}
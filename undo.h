@@ -0,0 +1,23 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+// bytes kept by the undo log; a power of two
+#define UNDO_BYTES (32 << 20)
+
+// longest entry
+#define UNDO_MAX_ENTRY 255
+
+// appends an entry of len bytes, dropping the oldest ones to make room
+void undo_push(const unsigned char* entry, int len);
+
+// copies the newest entry into entry and removes it; returns its length,
+// 0 if the log is empty
+int undo_pop(unsigned char* entry);
+
+// entries in the log
+unsigned long long undo_count(void);
+
+void undo_clear(void);
+void free_undo(void);
+
+#endif // UNDO_H